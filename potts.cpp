@@ -3,9 +3,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <utility>
-#include <set>
-#include <map>
+#include <vector>
 
 /*
     Note that if you IMPORT something, you best be
@@ -16,47 +16,114 @@
 #define  COLLAGEN_OFFSET  1	// 0 or 1
 #define  PERIMETER_OFFSET 0	// 0 or 1
 
+/*
+    CHECK_PERIMETERS compares the incrementally updated perimeters
+    against a full rebuild after every accepted flip (slow)
+*/
+
+#define  CHECK_PERIMETERS 0	// 0 or 1
+
+/*
+    CHECK_BLOBULAR does the same for the cached blobular line counts
+*/
+
+#define  CHECK_BLOBULAR   0	// 0 or 1
+
+/*
+    LATTICE_EDGE fixes N at compile time, which makes the lattice a
+    static array and every %N a constant; the LATTICE EDGE given at
+    run time then has to match.  With 0 the lattice is sized at run time.
+*/
+
+#define  LATTICE_EDGE     0	// 0 or the edge length
+
+/*
+    RANDOM_GENERATOR picks the random number generator (see potts_random_.h)
+*/
+
+#define  RANDOM_GENERATOR 0	// 0 xoshiro256**, 1 Philox4x32-10
+
+/*
+    MAX_CHUNK is the largest CHUNKSIZE the flip is compiled for; the
+    chunk is a fixed size array on the stack (see potts_flip_.h)
+*/
+
+#define  MAX_CHUNK        4	// 0 or more
+
+/*
+    PROFILE counts proposals, rejections and rebuilds and times the
+    phases of every flip, into aaa_log_.txt and aaa_profile_.json (see
+    potts_profile_.h); it costs a few clock reads a flip
+*/
+
+#define  PROFILE          0	// 0 or 1
+
 /*******************************************************************************/
 /*** Global Parameters ***/
 
+/*
+    These are only defaults: any of them can be changed at run time from
+    a config file or the command line (see potts_config_.h).
+*/
+
   /*** Random Number Generation ***/
 
   int seed = 				0; // use 1 for same sequence every time; use 0 for time-based randomness
 
   /*** Simulation Length ( = Loops * Flips ) ***/
 
-  const int numLoops =		10*15;
-  const int numFlips =		pow(2,6);
-  const int numPrint = 		numLoops/100;
+  int numLoops =		10*15;
+  int numFlips =		64;
+  int numPrint = 		0;   // 0 prints 100 lattices over the run
+  int snapshotFormat =	1;   // lattices as 0 text, 1 binary snapshots (see potts_snapshot_.h)
+  int checkpointEvery =	0;   // loops between checkpoints, 0 for 10 over the run, -1 for none (see potts_checkpoint_.h)
+  int outputQueue =		64;  // records the writer thread may fall behind by, 0 writes on the spot (see potts_writer_.h)
+
+  int chunkSize =		0;
 
-  const int chunkSize =		0;
+  /*** Parallelism ***/
+
+  /*const*/ int numThreads =	1;  // more than 1 flips with checkerboard sweeps (see potts_sweep_.h)
+  int numJobs =			0;  // simulations run at once in batch mode, 0 for one per processor
+  int numReplicas =		1;  // more than 1 runs parallel tempering, BETA to BETA MAX (see potts_tempering_.h)
 
   /*** Energies ***/
 
-  const double beta =		1.0;
+  double beta =		1.0;
+  double betaMax =		2.0;  // the coldest replica's beta, with REPLICAS
+  int swapEvery =		10;   // loops between tempering swaps
+
+  int acceptance =		1;  // 0 exp(), 1 table of exp() by energy change, 2 log threshold (see potts_flip_.h)
+  int engine =			0;  // 0 Metropolis, 1 n-fold way (see potts_nfold_.h)
 
   bool doPrinting = 		true;
 
-  const double J_air =		0.0;
-  const double J_cel =		0.0;
+  double J_air =		0.0;
+  double J_cel =		0.0;
 
-  const double J_col =		0.00000000;
+  double J_col =		0.00000000;
 
-  const double L_vol = 		.05;  //  penalty for large volume
-  /*const*/ double L_ani =	0.0; //  penalty for high anisotropy
-  /*const*/ double L_blb =	10;  //  penalty for wiggliness
+  double L_vol = 		.05;  //  penalty for large volume
+  double L_ani =		0.0; //  penalty for high anisotropy
+  int anisotropyMeasure =	0;   // 0 longest chord over width, 1 principal axes of the moments (see potts_analysis_.h)
+  double L_blb =		10;  //  penalty for wiggliness
 
   /*** System ***/
 
-  const int N =				120;
+  #if LATTICE_EDGE
+  const int N =				LATTICE_EDGE;
+  #else
+  int N =					120;
+  #endif
 
-  const int numCells =			1;
-  /*const*/ int numCollagen =	0;
+  int numCells =			1;
+  int numCollagen =		0;
 
-  const double cellSpawn = 	10.0;
-  const double cellRadius =	cellSpawn;
+  double cellSpawn = 		10.0;
+  int spawnPacking =		0;   // 0 cells dropped at random, 1 packed into an aggregate (see potts_spawn_.h)
+  double cellRadius =		10.0;
 
-  const int collagenWidth =	1;
+  int collagenWidth =		1;
 
   const double E = 2.718;
   int advanceAmount 	= (chunkSize+1)*2;
@@ -64,77 +131,136 @@
 /*******************************************************************************/
 /*** Global Variables ***/
 
-  int lattice[N][N][2] = {0};
-  std::map< int, std::set< std::pair<int, int> > > cellVolumeList;
-  std::map< int, std::set< std::pair<int, int> > > cellPerimeterList;
+/*
+    An N x N array of T, indexed a[i][j] like a plain 2D array.  With
+    LATTICE_EDGE it is one, otherwise it lives on the heap and has to be
+    allocated once N is known.
+*/
+
+  template <class T> struct siteArray
+  {
+    #if LATTICE_EDGE
+    T site[LATTICE_EDGE*LATTICE_EDGE];
+    void allocate() { memset( site, 0, sizeof(site) ); }
+    #else
+    T *site;
+    void allocate() { delete[] site; site = new T[N*N](); }
+    #endif
+    T *operator[](int i) { return site + i*N; }
+  };
+
+  siteArray<int[2]> lattice;
+  std::vector< std::vector< std::pair<int, int> > > cellVolumeList;
+  std::vector< std::vector< std::pair<int, int> > > cellPerimeterList;
+  siteArray<int> volumeSlot;
+  siteArray<int> perimeterSlot;
 
   double totalEnergy;
   double avg[3],dev[3];
 
-  const double targetVolume = 3.141593*cellRadius*cellRadius;
+  double targetVolume;
 
 /*******************************************************************************/
 /*** Functions ***/
 
+  #include "potts_config_.h"
+  #include "potts_random_.h"
+  #include "potts_profile_.h"
+  #include "potts_writer_.h"
+  #include "potts_cells_.h"
+  #include "potts_contacts_.h"
+  #include "potts_kernels_.h"
+  #include "potts_blobular_.h"
   #include "potts_print_.h"
   #include "potts_spawn_.h"
+  #include "potts_snapshot_.h"
   #include "potts_energy_.h"
   #include "potts_flip_.h"
+  #include "potts_sweep_.h"
+  #include "potts_nfold_.h"
   #include "potts_analysis_.h"
+  #include "potts_stats_.h"
+  #include "potts_checkpoint_.h"
+  #include "potts_batch_.h"
+  #include "potts_tempering_.h"
 
 /*******************************************************************************/
-/*** Main ***/
+/*** Runs one simulation with the current parameters, output to dname ***/
 
-//optional arguments: output directory name, numCollagen, doprinting
-int main(int argc, char *argv[])
+void simulate(const char *dname)
 {
-  printf("Running...\n");
-
-  if( argc > 2 )
-	  L_blb = atoi(argv[2]);
+  char   fname[400];
 
-  if( argc > 3 )
-	  doPrinting = false;
+  applyConfig();
 
-  char   dname[100];
-  char   fname[100];
+  if(numReplicas>1 && temperingRank<0){
+    printf("\n Nope... REPLICAS only works for a whole run, not in a batch\n\n");
+    exit(1);
+  }
 
   /* Seed random number generator */
 
   if(seed==0)
     seed=time(0);
-  srand(seed);
+  initRandom();
+  initProfile();
 
   /* Create output directory */
 
-  system("rm -rf output");
-
-  if(argv[1]==NULL)
-    strcpy(dname,"output");
-  else
-    strcpy(dname,argv[1]);
-  strcpy(fname,"mkdir ");
-  strcat(fname,dname);
-  strcat(fname," 2>/dev/null");
-  system(fname);
-
+  mkdir(dname,0755);
 
+  startWriter();
 
   /* Let there be life */
 
+  initCells();
+  initShapes();
+  initStats();
+
+  char   efile[400];
+  char   sfile[400];
+  char   cfile[400];
+  char   line[200];
+  int    length;
+  int    firstLoop = 0;
+
+  strcpy(efile,dname);
+  strcat(efile,"/aaa_energy_.txt");
+  strcpy(sfile,dname);
+  strcat(sfile,"/aaa_shapes_.txt");
+  strcpy(cfile,dname);
+  strcat(cfile,"/aaa_contacts_.txt");
+
+  if(resumeDir[0]!='\0'){
+  if(doPrinting){printf("\n  Warning: resuming cancer.\n\n");}
+  firstLoop = resumeState(dname);
+  initContacts();
+  if(numThreads>1)
+    initSweeps();
+  trimEnergies(efile,firstLoop+1);
+  trimEnergies(sfile,firstLoop+1);
+  trimEnergies(cfile,firstLoop/numPrint+1);
+  }
+  else{
+
   #if IMPORT
   if(doPrinting){printf("\n  Warning: importing cancer.\n\n");}
-  readCells();
-  readCollagen();
+  if( !importSnapshot("lattice_.snap") ){
+    readCells();
+    readCollagen();
+  }
   #else
   if(doPrinting){printf("\n  Warning: creating cancer.\n\n");}
   putCells();
   putCollagen();
   #endif
 
-  strcpy(fname,dname);
-  strcat(fname,"/lattice_0_.txt");
-  printLattice(fname);
+  initBlobular();
+  initContacts();
+  if(numThreads>1)
+    initSweeps();
+
+  saveLattice(dname,0);
   strcpy(fname,dname);
   strcat(fname,"/collagen_.txt");
   printCollagen(fname);
@@ -145,56 +271,83 @@ int main(int argc, char *argv[])
 
   totalEnergy=Hamiltonian();
 
-  strcpy(fname,dname);
-  strcat(fname,"/aaa_energy_.txt");
-  FILE* efile=fopen(fname,"w");
+  writeOutput(efile,"",0,false);
   if(doPrinting){
-  fprintf(efile,"%5d ",0);
-  fprintf(efile,"%8.3lf %8.3lf ",totalEnergy,0.0);
-  fprintf(efile,"%8.3lf %8.3lf ",avg[0],dev[0]);
-  fprintf(efile,"%8.3lf %8.3lf ",avg[1],dev[1]);
-  fprintf(efile,"%8.3lf %8.3lf ",avg[2],dev[2]);
-  fprintf(efile,"\n");
-  fflush(efile);
+  length  = sprintf(line,"%5d ",0);
+  length += sprintf(line+length,"%8.3lf %8.3lf ",totalEnergy,0.0);
+  length += sprintf(line+length,"%8.3lf %8.3lf ",avg[0],dev[0]);
+  length += sprintf(line+length,"%8.3lf %8.3lf ",avg[1],dev[1]);
+  length += sprintf(line+length,"%8.3lf %8.3lf ",avg[2],dev[2]);
+  length += sprintf(line+length,"\n");
+  writeOutput(efile,line,length,true);
+  writeOutput(sfile,"",0,false);
+  writeShapes(sfile,0);
+  writeOutput(cfile,"",0,false);
+  writeContacts(cfile,0);
+  }
   }
 
+  initCellEnergies();
+  if(engine==1)
+    initNfold();
+
   /* Perform flips and conditionally accept the change via the Metropolis algorithm */
 
-  int accepted;
+  int accepted = 0;   // stays 0 if a resumed run had no loops left
 
   if(doPrinting){printf("  Mutating: %d x 2^%d spin flips...\n\n",numLoops,(int)log2((double)numFlips));}
 
-  for(int outerCount=1; outerCount<=numLoops; outerCount++){
+  for(int outerCount=firstLoop+1; outerCount<=numLoops; outerCount++){
 
     printf("\r    count = %d",outerCount);
     fflush(stdout);
 
     accepted=0;
-    for(int count=0; count<numFlips; count++){
-      accepted+=flip();
-    }
-    //measureCells();
+    if(numThreads>1)
+      accepted=sweep(numFlips);
+    else if(engine==1)
+      accepted=nfoldFlips(numFlips);
+    else
+      for(int count=0; count<numFlips; count++){
+        accepted+=flip();
+      }
+    #if CHECK_PERIMETERS
+    checkContacts();
+    #endif
+    measureCells();
+    addStats((double)accepted/(double)numFlips);
+
+    PROFILE_START;
 
     if( doPrinting ){
-    fprintf(efile,"%5d ",outerCount);
-    fprintf(efile,"%8.3lf %8.3lf ",totalEnergy,(double)accepted/(double)numFlips);
-    fprintf(efile,"%8.3lf %8.3lf ",avg[0],dev[0]);
-    fprintf(efile,"%8.3lf %8.3lf ",avg[1],dev[1]);
-    fprintf(efile,"%8.3lf %8.3lf ",avg[2],dev[2]);
-    fprintf(efile,"\n");
-    fflush(efile);
+    length  = sprintf(line,"%5d ",outerCount);
+    length += sprintf(line+length,"%8.3lf %8.3lf ",totalEnergy,(double)accepted/(double)numFlips);
+    length += sprintf(line+length,"%8.3lf %8.3lf ",avg[0],dev[0]);
+    length += sprintf(line+length,"%8.3lf %8.3lf ",avg[1],dev[1]);
+    length += sprintf(line+length,"%8.3lf %8.3lf ",avg[2],dev[2]);
+    length += sprintf(line+length,"\n");
+    writeOutput(efile,line,length,true);
+    writeShapes(sfile,outerCount);
 
     if(outerCount%numPrint==0){
-      sprintf(fname,"%s/lattice_%d_.txt",dname,outerCount/numPrint);
-      printLattice(fname);
+      saveLattice(dname,outerCount/numPrint);
+      writeContacts(cfile,outerCount);
     }
     }
 
+    if(temperingRank>=0 && outerCount%swapEvery==0)
+      temperingSwap(outerCount);
+
+    if(checkpointEvery>0 && outerCount%checkpointEvery==0)
+      writeCheckpoint(dname,outerCount);
+
+    PROFILE_LAP( PHASE_OUTPUT );
+
   }
 
   //printf("\r    finished!              \n\n");
 
-  fclose(efile);
+  stopWriter();
 
   measureCells();
 
@@ -203,20 +356,64 @@ int main(int argc, char *argv[])
   strcat(fname,"/aaa_log_.txt");
   printLog(fname);
 
+  #if PROFILE
+  strcpy(fname,dname);
+  strcat(fname,"/aaa_profile_.json");
+  writeProfile(fname);
+  #endif
+
   /*** Show some stats ***/
   if( doPrinting ){
   printf("  Final statistics...\n\n");
-  printf("    acceptance ratio : %8.3lf\n\n",(double)accepted/(double)(numFlips));
+  if(firstLoop<numLoops)
+    printf("    acceptance ratio : %8.3lf\n\n",(double)accepted/(double)(numFlips));
   printf("    cell volume      : %8.3lf +/- %7.3lf\n",avg[0],dev[0]);
   printf("    cell perimeter   : %8.3lf +/- %7.3lf\n",avg[1],dev[1]);
   printf("    cell anisotropy  : %8.3lf +/- %7.3lf\n\n",avg[2],dev[2]);
   printf("  Done.\n\n");
   }
+}
+
+/*******************************************************************************/
+/*** Main ***/
+
+//optional arguments: output directory name, L_blb, doprinting, -c config, KEY=value, -b batch, -j jobs, -x export, -r resume
+#ifndef POTTS_BENCH   // potts_bench.cpp has its own
+
+int main(int argc, char *argv[])
+{
+  printf("Running...\n");
+
+  char   dname[100] = "output";
+
+  readArguments(argc, argv, dname);
+
+  if(exportFrom!=NULL){
+    exportSnapshot(exportFrom, exportTo);
+    return 0;
+  }
+
+  if(batchFile[0]!='\0'){
+    runBatch(batchFile, dname);
+    return 0;
+  }
+
+  if(resumeDir[0]=='\0')
+    system("rm -rf output");
+
+  if(numReplicas>1){
+    runTempering(dname);
+    return 0;
+  }
+
+  simulate(dname);
 
   return 0;
 
 }
 
+#endif
+
 
 
 
@@ -1,18 +1,97 @@
 /*******************************************************************************/
 
+#include <vector>
+
 /*** CELL ANALYSIS FUNCTIONS ***/
 
+  void    initShapes();
+  void    shapeChanged(int);
   void    measureCells();
   double  measureAnisotropy(int);
+  double  measureAnisotropy(int, const chunkView&);
+  double  momentAnisotropy(int, const chunkView&);
+
+  struct hullPoint
+  {
+    int x, y;      // unwrapped around the cell's anchor
+    int site;      // i*N+j on the lattice
+  };
+
+  int     farthestPerimeterPair(int cell, const chunkView &view, int &siteA, int &siteB);
+  void    addHullSite(int i, int j, int ai, int aj);
+  bool    isTrialPerimeter(int cell, int i, int j, const chunkView &view);
+  long    hullTurn(const hullPoint &a, const hullPoint &b, const hullPoint &c);
+  void    keepFarther(const hullPoint &a, const hullPoint &b, int &distmax, int &siteA, int &siteB);
+
+  thread_local std::vector<hullPoint> rowLow, rowHigh;   // the ends of every row of the cell
+  thread_local std::vector<hullPoint> hullSites, hull;
+
+  std::vector<double> cellAnisotropy;   // as last measured
+  std::vector<char>   shapeStale;       // changed by a flip since
+
+/*
+    The anisotropy of a cell is its longest chord, between the two
+    perimeter sites farthest apart, over its width across the middle of
+    that chord.  The farthest pair is found in O(P) rather than by
+    trying every pair: the perimeter sites are unwrapped around the
+    anchor of the cell's moments (which is fine as long as the cell is
+    less than half the box across, as it always had to be), only the
+    rows of its bounding box are looked at, only the two ends of each
+    row can be on the convex hull, the hull of those comes out of a
+    monotone chain without sorting, and rotating calipers walk it for
+    the pair.  Pairs equally far apart are told apart by their lattice
+    sites, so the answer doesn't depend on the order of the perimeter
+    list.
+
+    measureAnisotropy(cell,view) measures the cell as it would be after
+    a trial flip, without touching the lattice or the perimeter lists:
+    the sites within a site of the chunk are looked at through the view,
+    the rest of the perimeter can't have changed.  That is what lets
+    flip() afford L_ani.
+
+    With ANISOTROPY MEASURE 1 the anisotropy is instead the ratio of the
+    cell's principal axes, sqrt(l1/l2) for the eigenvalues l1 >= l2 of
+    the covariance of its sites (each site counted as a unit square, so
+    a line of sites still has a width), from the moments addVolume()
+    and removeVolume() keep.  It is 1 for a disc, like the chord over
+    the width, but smoother, and costs O(1) whatever the cell's size,
+    trial flip or not.  The covariance is worked out from the sums in
+    integers, so it doesn't depend on where the anchor happens to be.
+
+    measureCells() keeps every cell's anisotropy from one call to the
+    next, and only measures again the cells an accepted flip has
+    changed since (updateCellEnergy marks them), so it is cheap enough
+    to call every loop.
+*/
+
+/*******************************************************************************/
+/*** Forgets every cell's shape ***/
+
+void initShapes()
+{
+  cellAnisotropy.assign( numCells+1, 0.0 );
+  shapeStale.assign( numCells+1, 1 );
+}
+
+// a flip has changed the cell
+
+void shapeChanged(int cell)
+{
+  shapeStale[cell] = 1;
+}
 
 /*******************************************************************************/
 /*** Measure cell properties ***/
 
 void measureCells()
 {
-  double cellAnisotropy[numCells+1];
+  if( (int)shapeStale.size()!=numCells+1 )
+    initShapes();
   for(int cell=1;cell<=numCells;cell++)
-    cellAnisotropy[cell]=measureAnisotropy(cell);
+    if(shapeStale[cell]){
+      cellAnisotropy[cell]=measureAnisotropy(cell);
+      shapeStale[cell]=0;
+    }
 
   for(int n=0;n<3;n++){
     avg[n]=0.0;
@@ -39,48 +118,35 @@ void measureCells()
 /*******************************************************************************/
 /*** Measure anisotropy ***/
 
+double measureAnisotropy(int cell)
+{
+  return measureAnisotropy( cell, noChunk );
+}
+
 // NB: THIS WILL FUCK UP IF A CELL GETS BIGGER THAN HALF THE BOX LENGTH.
 
-double measureAnisotropy(int cell)
+double measureAnisotropy(int cell, const chunkView &view)
 {
+  if(anisotropyMeasure==1)
+    return momentAnisotropy( cell, view );
 
-  int    i,j,xi,xf,yi,yf,dx,dy,s;
-  int    dist,distmax,distind[4];
+  int    xi,xf,yi,yf,dx,dy,s;
+  int    distmax,siteA,siteB;
   double slope,error;
 
   /*
-    Go through every pair of perimeter spins, find the pair
-    which are furthest apart, and record their positions.
+    Find the pair of perimeter spins which are furthest
+    apart, and their positions.
   */
 
-  distmax=0;
-
-  for(std::set< std::pair<int, int> >::const_iterator it1 = cellPerimeterList[cell].begin(); it1!=cellPerimeterList[cell].end(); ++it1){
-	  xi = it1->first;
-	  yi = it1->second;
-
-	  for(std::set< std::pair<int, int> >::const_iterator it2 = cellPerimeterList[cell].begin(); it2!=cellPerimeterList[cell].end(); ++it2){
-      xf = it2->first;
-      yf = it2->second;
-      dx=xf-xi-N*(int)floor((float)(xf-xi)/(float)N+0.499);
-      dy=yf-yi-N*(int)floor((float)(yf-yi)/(float)N+0.499);
-      dist=dx*dx+dy*dy;
-      if(dist>distmax){
-        distmax=dist;
-        distind[0]=xi;
-        distind[1]=xf;
-        distind[2]=yi;
-        distind[3]=yf;
-      }
-
+  distmax = farthestPerimeterPair( cell, view, siteA, siteB );
+  if(distmax<0)
+    return 0.0;
 
-    }
-  }
-
-  xi=distind[0];
-  xf=distind[1];
-  yi=distind[2];
-  yf=distind[3];
+  xi=siteA/N;
+  xf=siteB/N;
+  yi=siteA%N;
+  yf=siteB%N;
 
   /*
      Find the midpoint.
@@ -116,18 +182,18 @@ double measureAnisotropy(int cell)
   yi = ym;
   error = fabs(slope);
 
-  if(lattice[xi][yi][0]!=cell)
+  if(view.at(xi,yi)!=cell)
     goto donei;
 
   while(1){
-    if(lattice[xi][yi][0]!=cell){
+    if(view.at(xi,yi)!=cell){
       xi=(N+xi-1)%N;
       goto donei;
     }
     while(error>0.5){
       yi=(N+yi+s)%N;
       error-=1.0;
-      if(lattice[xi][yi][0]!=cell){
+      if(view.at(xi,yi)!=cell){
         yi=(N+yi-s)%N;
         goto donei;
       }
@@ -142,18 +208,18 @@ double measureAnisotropy(int cell)
   yf = ym;
   error = fabs(slope);
 
-  if(lattice[xf][yf][0]!=cell)
+  if(view.at(xf,yf)!=cell)
     goto donef;
 
   while(1){
-    if(lattice[xf][yf][0]!=cell){
+    if(view.at(xf,yf)!=cell){
       xf=(xf+1)%N;
       goto donef;
     }
     while(error>0.5){
       yf=(N+yf-s)%N;
       error-=1.0;
-      if(lattice[xf][yf][0]!=cell){
+      if(view.at(xf,yf)!=cell){
         yf=(N+yf+s)%N;
         goto donef;
       }
@@ -181,44 +247,202 @@ double measureAnisotropy(int cell)
   return ani;
 }
 
+/*******************************************************************************/
+/*** Finds the two perimeter sites of a cell farthest apart ***/
 
+// returns their squared distance, or -1 if the cell has no perimeter
 
+int farthestPerimeterPair(int cell, const chunkView &view, int &siteA, int &siteB)
+{
+  if( (int)rowLow.size()!=N ){
+    rowLow.resize(N);
+    rowHigh.resize(N);
+  }
 
+  // the sites are unwrapped like the cell's moments, and only the rows
+  // of its bounding box (and of the chunk) can have any
+  int ai, aj, first, last;
+  if( !cellPerimeterList[cell].empty() ){
+    const cellBox &box = cellBounds(cell);
+    ai = cellMoment[cell].ai;
+    aj = cellMoment[cell].aj;
+    first = box.xmin-view.side-1;
+    last = box.xmax+view.side+1;
+  }
+  else if( view.side>0 ){
+    ai = view.i0;
+    aj = view.j0;
+    first = -1;
+    last = view.side;
+  }
+  else
+    return -1;
 
+  first = first<-N/2 ? 0 : first+N/2;
+  last = last>=N-N/2 ? N-1 : last+N/2;
+  for(int r=first;r<=last;r++){
+    rowLow[r].y = N;
+    rowHigh[r].y = -N;
+  }
 
+  for(int n=0; n<(int)cellPerimeterList[cell].size(); n++){
+    int i = cellPerimeterList[cell][n].first;
+    int j = cellPerimeterList[cell][n].second;
+    if( view.side>0 && (N+i-view.i0+1)%N<view.side+2 && (N+j-view.j0+1)%N<view.side+2 )
+      continue;
+    addHullSite( i, j, ai, aj );
+  }
+  for(int di=-1; view.side>0 && di<=view.side; di++)
+    for(int dj=-1; dj<=view.side; dj++){
+      int i = (N+view.i0+di)%N;
+      int j = (N+view.j0+dj)%N;
+      if( isTrialPerimeter( cell, i, j, view ) )
+        addHullSite( i, j, ai, aj );
+    }
 
+  // the ends of the rows, in order of x and then y
+  hullSites.clear();
+  for(int r=first;r<=last;r++){
+    if( rowLow[r].y>rowHigh[r].y )
+      continue;
+    hullSites.push_back( rowLow[r] );
+    if( rowHigh[r].y!=rowLow[r].y )
+      hullSites.push_back( rowHigh[r] );
+  }
+  if( hullSites.empty() )
+    return -1;
+
+  // monotone chain, lower hull then upper, anticlockwise without collinear sites
+  int size = (int)hullSites.size();
+  int h = 0;
+  hull.resize( 2*size );
+  for(int n=0;n<size;n++){
+    while( h>=2 && hullTurn( hull[h-2], hull[h-1], hullSites[n] )<=0 )
+      h--;
+    hull[h++] = hullSites[n];
+  }
+  for(int n=size-2, lower=h+1; n>=0; n--){
+    while( h>=lower && hullTurn( hull[h-2], hull[h-1], hullSites[n] )<=0 )
+      h--;
+    hull[h++] = hullSites[n];
+  }
+  if( size>1 )
+    h--;   // the first site came round again
 
+  int distmax = -1;
+  siteA = siteB = 0;
 
+  if( h<3 ){
+    keepFarther( hull[0], hull[h-1], distmax, siteA, siteB );
+    return distmax;
+  }
 
+  // rotating calipers: every antipodal pair, both ends of parallel edges included
+  for(int n=0, m=1; n<h; n++){
+    int next = (n+1)%h;
+    long turn;
+    while( true ){
+      hullPoint edge = { hull[next].x-hull[n].x, hull[next].y-hull[n].y, 0 };
+      hullPoint across = { hull[(m+1)%h].x-hull[m].x, hull[(m+1)%h].y-hull[m].y, 0 };
+      turn = (long)edge.x*across.y - (long)edge.y*across.x;
+      if( turn<=0 )
+        break;
+      m = (m+1)%h;
+    }
+    keepFarther( hull[n], hull[m], distmax, siteA, siteB );
+    keepFarther( hull[next], hull[m], distmax, siteA, siteB );
+    if( turn==0 ){
+      keepFarther( hull[n], hull[(m+1)%h], distmax, siteA, siteB );
+      keepFarther( hull[next], hull[(m+1)%h], distmax, siteA, siteB );
+    }
+  }
 
+  return distmax;
+}
 
+// files a perimeter site under its row, if it is one of the row's ends
 
+void addHullSite(int i, int j, int ai, int aj)
+{
+  hullPoint p = { minimumImage(i-ai), minimumImage(j-aj), i*N+j };
+  int r = p.x+N/2;
+  if( r<0 || r>=N )
+    return;   // can't happen with minimumImage() as it is, but rowLow has N rows
+  if( p.y<rowLow[r].y )
+    rowLow[r] = p;
+  if( p.y>rowHigh[r].y )
+    rowHigh[r] = p;
+}
 
+// is (i,j) on the perimeter of the cell once the view's chunk is flipped?
 
+bool isTrialPerimeter(int cell, int i, int j, const chunkView &view)
+{
+  return view.at(i,j)==cell &&
+         ( view.at((i+1)%N,j)!=cell || view.at((N+i-1)%N,j)!=cell ||
+           view.at(i,(j+1)%N)!=cell || view.at(i,(N+j-1)%N)!=cell );
+}
 
+// > 0 if a, b, c turn anticlockwise
 
+long hullTurn(const hullPoint &a, const hullPoint &b, const hullPoint &c)
+{
+  return (long)(b.x-a.x)*(c.y-a.y) - (long)(b.y-a.y)*(c.x-a.x);
+}
 
+// keeps a pair if it is farther apart, or as far and on lower sites
 
+void keepFarther(const hullPoint &a, const hullPoint &b, int &distmax, int &siteA, int &siteB)
+{
+  int dist = (a.x-b.x)*(a.x-b.x) + (a.y-b.y)*(a.y-b.y);
+  int lo = a.site<b.site ? a.site : b.site;
+  int hi = a.site<b.site ? b.site : a.site;
+  if( dist>distmax || ( dist==distmax && ( lo<siteA || ( lo==siteA && hi<siteB ) ) ) ){
+    distmax = dist;
+    siteA = lo;
+    siteB = hi;
+  }
+}
 
+/*******************************************************************************/
+/*** Anisotropy from the second moments ***/
 
+double momentAnisotropy(int cell, const chunkView &view)
+{
+  cellMoments m = cellMoment[cell];
+
+  // the chunk's sites going into or out of the cell
+  for(int di=0;di<view.side;di++)
+    for(int dj=0;dj<view.side;dj++){
+      int i = (view.i0+di)%N;
+      int j = (view.j0+dj)%N;
+      int was = lattice[i][j][0]==cell, is = view.cell==cell;
+      if(was==is)
+        continue;
+      long sign = is-was;
+      long x = minimumImage(i-m.ai);
+      long y = minimumImage(j-m.aj);
+      m.n   += sign;
+      m.sx  += sign*x;
+      m.sy  += sign*y;
+      m.sxx += sign*x*x;
+      m.syy += sign*y*y;
+      m.sxy += sign*x*y;
+    }
 
+  if(m.n<=0)
+    return 0.0;
 
+  // n^2 times the covariance, exactly
+  double n2 = (double)m.n*m.n;
+  double cxx = (m.n*m.sxx-m.sx*m.sx)/n2 + 1.0/12.0;
+  double cyy = (m.n*m.syy-m.sy*m.sy)/n2 + 1.0/12.0;
+  double cxy = (m.n*m.sxy-m.sx*m.sy)/n2;
 
+  double half = 0.5*(cxx+cyy);
+  double spread = sqrt( 0.25*(cxx-cyy)*(cxx-cyy) + cxy*cxy );
 
+  return sqrt( (half+spread)/(half-spread) );
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+/*******************************************************************************/
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*******************************************************************************/
+/*** BATCH FUNCTIONS ***/
+
+  void  simulate(const char *dname);
+  void  runBatch(const char *fname, const char *dname);
+  void  runReplica(const char *line, int n, const char *dname);
+
+/*
+    potts -b batch [-j jobs] [directory] [KEY=value ...] runs every
+    line of the batch file as a simulation of its own, numJobs at a time.
+    A line holds the same arguments as the command line, e.g.
+
+      dir_1  BLOBULAR=10 NUM_COLLAGEN=5
+      dir_2  -c base.txt SEED=7
+
+    on top of whatever the command line itself set.  The line's directory
+    (replica_<line> if there is none) is made inside the batch directory,
+    and what the simulation prints goes to aaa_stdout_.txt in there.
+
+    The simulation state is all global, so every replica runs in a
+    process forked off for it, with a copy of the parameters as they
+    were before the batch started.  Replicas without a SEED get the time
+    plus their line number, so they don't all draw the same numbers.
+*/
+
+/*******************************************************************************/
+/*** Runs every line of a batch file, numJobs at a time ***/
+
+void runBatch(const char *fname, const char *dname)
+{
+  std::vector<std::string> lines;
+  char line[500];
+
+  FILE* inFile=fopen(fname,"r");
+  if(inFile==NULL){
+    printf("\n Nope... missing %s\n\n",fname);
+    exit(1);
+  }
+  while( fgets(line,sizeof(line),inFile)!=NULL ){
+    if( line[strspn(line," \t\r\n")]=='\0' || line[0]=='#' )
+      continue;
+    lines.push_back( line );
+  }
+  fclose(inFile);
+
+  int jobs = numJobs;
+  if(jobs<=0)
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if(jobs<=0)
+    jobs = 1;
+
+  mkdir(dname,0755);
+
+  printf("  Running %d simulations, %d at a time...\n\n",(int)lines.size(),jobs);
+  fflush(stdout);
+
+  int running = 0, finished = 0, failed = 0;
+  int status;
+
+  for(int n=0;n<(int)lines.size() || running>0;){
+
+    if(n<(int)lines.size() && running<jobs){
+      pid_t pid = fork();
+      if(pid==0){
+        runReplica( lines[n].c_str(), n+1, dname );
+        _exit(0);
+      }
+      if(pid<0){
+        printf("\n Nope... can't start simulation %d\n\n",n+1);
+        failed++;
+      }
+      else
+        running++;
+      n++;
+      continue;
+    }
+
+    if(wait(&status)<0)
+      break;
+    running--;
+    finished++;
+    if( !WIFEXITED(status) || WEXITSTATUS(status)!=0 )
+      failed++;
+
+    printf("\r    finished = %d of %d",finished,(int)lines.size());
+    fflush(stdout);
+  }
+
+  printf("\n\n");
+  if(failed>0)
+    printf("  Warning: %d simulations failed.\n\n",failed);
+  printf("  Done.\n\n");
+}
+
+/*******************************************************************************/
+/*** Runs line n of a batch file, in its own process ***/
+
+void runReplica(const char *line, int n, const char *dname)
+{
+  char  copy[500];
+  char *args[100];
+  int   count = 0;
+
+  strncpy( copy, line, sizeof(copy)-1 );
+  copy[sizeof(copy)-1] = '\0';
+
+  args[count++] = (char*)"potts";
+  for(char *arg=strtok(copy," \t\r\n"); arg!=NULL && count<100; arg=strtok(NULL," \t\r\n"))
+    args[count++] = arg;
+
+  char  sub[100];
+  char  rdir[300];
+  char  fname[350];
+
+  sprintf(sub,"replica_%d",n);
+  readArguments(count, args, sub);
+  sprintf(rdir,"%s/%s",dname,sub);
+
+  if(seed==0)
+    seed = time(0)+n;
+
+  mkdir(rdir,0755);
+  sprintf(fname,"%s/aaa_stdout_.txt",rdir);
+  if( freopen(fname,"w",stdout)==NULL )
+    _exit(1);
+
+  simulate(rdir);
+
+  fflush(stdout);
+}
+
+/*******************************************************************************/
@@ -0,0 +1,317 @@
+#define POTTS_BENCH
+#include "potts.cpp"
+#include <new>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/*******************************************************************************/
+/*** BENCHMARKS ***/
+
+/*
+    potts_bench [-o file.json] [-t seconds] [-n edges] [-c cells] [-r radii]
+                [KEY=value ...]
+
+    Times the kernels of a run on lattices of every edge in -n, with
+    every number of cells in -c and every cell radius in -r (comma
+    separated lists).  Each lattice is set up as potts would, with the
+    cells spawned at their target radius, and flipped LOOPS*FLIPS times
+    to let the cells settle before anything is timed.  Any other
+    parameter can be set with KEY=value as usual.
+
+    Every kernel is run in doubling batches until a batch takes at least
+    -t seconds (0.1 by default), and reported per call, along with the
+    operator new calls made per call.  -o also writes the results as
+    JSON, in the layout Google Benchmark uses, for comparing runs.
+
+    Once the cells have settled, flipping should not touch the heap at
+    all, and it exits 1 if it did on any lattice, after writing out the
+    results.  The cell lists and blobular samples still grow while a
+    cell reaches a size it hasn't had before, so give it enough LOOPS
+    for that (the default ones do).
+*/
+
+  struct benchResult
+  {
+    std::string   name;
+    long          iterations;
+    double        ns;            // per call
+    double        allocations;   // per call
+  };
+
+  std::vector<benchResult> benchResults;
+  double benchTime = 0.1;
+
+  unsigned long allocations = 0;
+  bool          counting = false;
+  volatile double benchSink;     // keeps results from being optimized away
+
+  template <class F> void runBench(const std::string &name, F body);
+  void  setupBench();
+  void  writeJSON(const char *fname);
+  std::vector<int> parseList(const char *list);
+
+/*******************************************************************************/
+/*** Counts heap allocations while timing ***/
+
+// new takes from malloc and delete gives back to free, on purpose; gcc
+// sees the two and warns they don't match
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size)
+{
+  if(counting)
+    allocations++;
+  void *p = malloc( size>0 ? size : 1 );
+  if(p==NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+#pragma GCC diagnostic pop
+
+/*******************************************************************************/
+/*** Times body(n) for n = 0, 1, 2, ... ***/
+
+template <class F> void runBench(const std::string &name, F body)
+{
+  benchResult r;
+  double seconds = 0.0;
+
+  r.name = name;
+  r.iterations = 1;
+
+  while(true){
+    allocations = 0;
+    counting = true;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(long n=0;n<r.iterations;n++)
+      body(n);
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    counting = false;
+
+    seconds = std::chrono::duration<double>(stop-start).count();
+    if(seconds>=benchTime || r.iterations>=(1L<<30))
+      break;
+    r.iterations *= 2;
+  }
+
+  r.ns = 1e9*seconds/r.iterations;
+  r.allocations = (double)allocations/r.iterations;
+  benchResults.push_back(r);
+
+  printf("%-44s %10ld %12.1lf ns %10.4g allocs\n",name.c_str(),r.iterations,r.ns,r.allocations);
+}
+
+/*******************************************************************************/
+/*** Sets up a lattice as simulate() does, and lets it settle ***/
+
+void setupBench()
+{
+  applyConfig();
+  if(seed==0)
+    seed=time(0);
+  initRandom();
+
+  initCells();
+  initShapes();
+  putCells();
+  putCollagen();
+  initBlobular();
+  initContacts();
+  measureCells();
+  totalEnergy=Hamiltonian();
+  initCellEnergies();
+
+  long flips = (long)numLoops*numFlips;
+  for(long n=0;n<flips;n++)
+    totalEnergy += flip() ? deltaEnergy : 0.0;
+}
+
+/*******************************************************************************/
+/*** Runs every kernel on every lattice ***/
+
+int main(int argc, char *argv[])
+{
+  char  dname[100] = "output";
+  const char *jsonFile = NULL;
+  std::vector<int> edges, cells, radii;
+
+  #if LATTICE_EDGE
+  edges.push_back( LATTICE_EDGE );
+  #else
+  edges.push_back( 120 );
+  edges.push_back( 240 );
+  #endif
+  cells.push_back( 1 );
+  cells.push_back( 8 );
+  radii.push_back( 5 );
+  radii.push_back( 10 );
+
+  // our own options first, the rest as potts takes them
+  std::vector<char*> args;
+  args.push_back( argv[0] );
+  for(int n=1;n<argc;n++){
+    if( strcmp(argv[n],"-o")==0 && n+1<argc )
+      jsonFile = argv[++n];
+    else if( strcmp(argv[n],"-t")==0 && n+1<argc )
+      benchTime = atof( argv[++n] );
+    else if( strcmp(argv[n],"-n")==0 && n+1<argc )
+      edges = parseList( argv[++n] );
+    else if( strcmp(argv[n],"-c")==0 && n+1<argc )
+      cells = parseList( argv[++n] );
+    else if( strcmp(argv[n],"-r")==0 && n+1<argc )
+      radii = parseList( argv[++n] );
+    else
+      args.push_back( argv[n] );
+  }
+
+  doPrinting = false;
+  readArguments( args.size(), &args[0], dname );
+
+  bool flipAllocates = false;
+  char fname[100] = "potts_bench_lattice_.txt";
+
+  for(int e=0;e<(int)edges.size();e++){
+    for(int c=0;c<(int)cells.size();c++){
+      for(int r=0;r<(int)radii.size();r++){
+
+        #if !LATTICE_EDGE
+        N = edges[e];
+        #endif
+        numCells = cells[c];
+        cellRadius = radii[r];
+        cellSpawn = radii[r];
+        setupBench();
+
+        char suffix[100];
+        sprintf(suffix,"/N:%d/cells:%d/radius:%d",N,numCells,radii[r]);
+        std::string s = suffix;
+
+        // proposals and sites to cycle through
+        std::vector<int> proposals;
+        for(int n=0;n<1024;n++){
+          choose();
+          proposals.push_back( iSite );
+          proposals.push_back( jSite );
+          proposals.push_back( oldCell );
+          proposals.push_back( newCell );
+        }
+        std::vector< std::pair<int, int> > sites;
+        for(int cell=1;cell<=numCells;cell++)
+          sites.insert( sites.end(), cellPerimeterList[cell].begin(), cellPerimeterList[cell].end() );
+
+        runBench( "choose"+s, [](long){ choose(); } );
+        runBench( "maintainsContiguity"+s, [&](long n){
+          int k = 4*(n%1024);
+          iSite = proposals[k];
+          jSite = proposals[k+1];
+          oldCell = proposals[k+2];
+          newCell = proposals[k+3];
+          benchSink = maintainsContiguity();
+        } );
+        runBench( "inplaneEnergy"+s, [&](long n){
+          std::pair<int, int> &p = sites[ n%sites.size() ];
+          benchSink = inplaneEnergy( p.first, p.second );
+        } );
+        runBench( "interactionEnergy"+s, [](long){
+          double energy = 0.0;
+          for(int cell=1;cell<=numCells;cell++)
+            energy += interactionEnergy( cell );
+          benchSink = energy;
+        } );
+        runBench( "latticeInteractionEnergy"+s, [](long){ benchSink = latticeInteractionEnergy(); } );
+        runBench( "boundaryMask"+s, [](long){ packLattice(); boundaryMask(); } );
+        runBench( "blobularEnergy"+s, [](long n){ benchSink = blobularEnergy( 1+n%numCells ); } );
+        runBench( "measureAnisotropy"+s, [](long n){ benchSink = measureAnisotropy( 1+n%numCells ); } );
+        runBench( "flip"+s, [](long){ totalEnergy += flip() ? deltaEnergy : 0.0; } );
+        flipAllocates = flipAllocates || benchResults.back().allocations>0;
+
+        // these two reorder the perimeter lists or write a file, so go last
+        runBench( "adjustPerimeters"+s, [](long n){ adjustPerimeters( 1+n%numCells ); } );
+        runBench( "printLattice"+s, [&](long){ printLattice(fname); } );
+        remove( fname );
+      }
+    }
+  }
+
+  if(jsonFile!=NULL)
+    writeJSON(jsonFile);
+
+  if(flipAllocates){
+    printf("\n Nope... flip() allocated once settled, try more LOOPS\n\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/*******************************************************************************/
+/*** Writes the results as JSON ***/
+
+void writeJSON(const char *fname)
+{
+  FILE *pfile=fopen(fname,"w");
+  if(pfile==NULL){
+    printf("\n Nope... can't write %s\n\n",fname);
+    exit(1);
+  }
+
+  time_t now = time(0);
+  char date[100];
+  strftime(date,sizeof(date),"%Y-%m-%dT%H:%M:%S",localtime(&now));
+
+  fprintf(pfile,"{\n  \"context\": {\n");
+  fprintf(pfile,"    \"date\": \"%s\",\n",date);
+  fprintf(pfile,"    \"executable\": \"potts_bench\",\n");
+  fprintf(pfile,"    \"seed\": %d,\n",seed);
+  fprintf(pfile,"    \"min_time\": %g,\n",benchTime);
+  fprintf(pfile,"    \"settle_flips\": %ld,\n",(long)numLoops*numFlips);
+  fprintf(pfile,"    \"chunk_size\": %d,\n",chunkSize);
+  fprintf(pfile,"    \"acceptance\": %d,\n",acceptance);
+  fprintf(pfile,"    \"blobular\": %g\n",L_blb);
+  fprintf(pfile,"  },\n  \"benchmarks\": [\n");
+  for(int n=0;n<(int)benchResults.size();n++){
+    benchResult &r = benchResults[n];
+    fprintf(pfile,"    {\n");
+    fprintf(pfile,"      \"name\": \"%s\",\n",r.name.c_str());
+    fprintf(pfile,"      \"iterations\": %ld,\n",r.iterations);
+    fprintf(pfile,"      \"real_time\": %.3lf,\n",r.ns);
+    fprintf(pfile,"      \"time_unit\": \"ns\",\n");
+    fprintf(pfile,"      \"allocations\": %.6g\n",r.allocations);
+    fprintf(pfile,"    }%s\n", n+1<(int)benchResults.size() ? "," : "");
+  }
+  fprintf(pfile,"  ]\n}\n");
+  fclose(pfile);
+}
+
+/*******************************************************************************/
+/*** "100,200" to its numbers ***/
+
+std::vector<int> parseList(const char *list)
+{
+  std::vector<int> values;
+  const char *p = list;
+  while(*p){
+    values.push_back( atoi(p) );
+    p = strchr(p,',');
+    if(p==NULL)
+      break;
+    p++;
+  }
+  return values;
+}
+
+/*******************************************************************************/
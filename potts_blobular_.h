@@ -0,0 +1,479 @@
+#include <math.h>
+#include <utility>
+#include <vector>
+
+/*******************************************************************************/
+/*** BLOBULAR ENERGY CACHE ***/
+
+  struct blobularCache
+  {
+    int spacing;   // roughly one perimeter site in spacing is sampled (0 until built)
+    int count;     // number of sampled pairs whose line leaves the cell
+    int size;      // number of sampled sites
+    int capacity;  // row length of outside
+    std::vector< std::pair<int, int> > sample;
+    std::vector<char> outside;   // outside[a*capacity+b]: line from sample a to sample b leaves the cell
+    std::vector< std::pair<int, char> > pending;   // re-tested pairs of the flip under consideration
+    std::vector< std::pair<int, int> > offset;     // of each sample from the chunk under consideration
+    int pendingCount;
+    bool tried;    // pending holds the flip under consideration
+  };
+
+  void    initBlobular();
+  void    buildBlobular(int cell);
+  double  blobularPenalty(int cell, int count);
+  double  cachedBlobularEnergy(int cell);
+  double  trialBlobularEnergy(int cell, int ci, int cj, const chunkView &trial);
+  void    acceptBlobular(int cell, int ci, int cj);
+  void    resampleBlobular(int cell, int ci, int cj);
+  void    rejectBlobular(int cell);
+  void    checkBlobular(int cell);
+  int     countBlobular(int cell);
+  bool    leavesCell(int cell, int ai, int aj, int bi, int bj);
+  template <class View> bool leavesCell(int cell, int ai, int aj, int bi, int bj, const View &view);
+  bool    lineNear(int ax, int ay, int dx, int dy, int r);
+  int     minimumImage(int d);
+  bool    isSampled(int i, int j, int spacing);
+  int     sampleSpacing(int perimeter, int current);
+  void    addSample(int cell, int i, int j);
+  void    removeSample(int cell, int n);
+
+  std::vector<blobularCache> blobular;
+  siteArray<int> sampleSlot;   // position of a site in its cell's sample, or -1
+  siteArray<int> sampleCell;   // the cell whose sample that is
+
+/*
+    The blobular energy tests lines between pairs of sampled perimeter
+    sites.  Every cell keeps the sampled sites and the result of every
+    pair's line test between flips, so a flip only re-tests the pairs
+    whose line passes near the flipped chunk, and only sites whose
+    perimeter status changed are added to or dropped from the sample.
+
+    Whether a site is sampled depends on the site alone (see isSampled),
+    not on its position in the perimeter list, so the sample does not
+    shuffle around as the perimeter changes.
+
+    During a flip:
+      cachedBlobularEnergy  - energy before the flip
+      trialBlobularEnergy   - energy with the chunk flipped, as the
+                              trial view has it, and the sample as it
+                              was (the lattice isn't touched)
+      acceptBlobular /
+      resampleBlobular      - once the perimeters have been adjusted
+      rejectBlobular        - otherwise
+
+    With L_blb = 0 none of it is kept up, the energy is 0 regardless.
+*/
+
+/*******************************************************************************/
+/*** Builds the caches of every cell ***/
+
+void initBlobular()
+{
+  blobular.assign( numCells+1, blobularCache() );
+
+  sampleSlot.allocate();
+  sampleCell.allocate();
+
+  for(int i=0;i<N;i++){
+    for(int j=0;j<N;j++){
+      sampleSlot[i][j] = -1;
+      sampleCell[i][j] = 0;
+    }
+  }
+
+  for(int cell=1;cell<=numCells;cell++){
+    blobular[cell].spacing = 0;
+    blobular[cell].size = 0;
+    blobular[cell].capacity = 0;
+    buildBlobular(cell);
+  }
+}
+
+/*******************************************************************************/
+/*** (Re)builds the cache of a single cell from scratch ***/
+
+void buildBlobular(int cell)
+{
+  blobularCache &b = blobular[cell];
+
+  PROFILE_COUNT( PROFILE_BLOBULAR, 1 );
+
+  for(int n=0;n<b.size;n++)
+    sampleSlot[ b.sample[n].first ][ b.sample[n].second ] = -1;
+
+  b.spacing = sampleSpacing( cellPerimeterList[cell].size(), b.spacing );
+  b.count = 0;
+  b.size = 0;
+  b.sample.clear();
+  b.pending.clear();
+  b.pendingCount = 0;
+  b.tried = false;
+
+  for(int n=0;n<(int)cellPerimeterList[cell].size();n++)
+    if( isSampled( cellPerimeterList[cell][n].first, cellPerimeterList[cell][n].second, b.spacing ) )
+      addSample( cell, cellPerimeterList[cell][n].first, cellPerimeterList[cell][n].second );
+}
+
+/*******************************************************************************/
+/*** Blobular energy of a cell whose sampled lines leave it count times ***/
+
+double blobularPenalty(int cell, int count)
+{
+  // count*log(count) goes to 0 as count does
+  if(count==0)
+    return 0.0;
+
+  return L_blb * (double)count * log((double)count) / (double)(cellPerimeterList[cell].size());
+}
+
+/*******************************************************************************/
+/*** Blobular energy of a cell as it stands ***/
+
+double cachedBlobularEnergy(int cell)
+{
+  return blobularPenalty( cell, blobular[cell].count );
+}
+
+/*******************************************************************************/
+/*** Blobular energy of a cell with the chunk around (ci,cj) flipped ***/
+
+double trialBlobularEnergy(int cell, int ci, int cj, const chunkView &trial)
+{
+  if(L_blb==0)
+    return 0.0;
+
+  blobularCache &b = blobular[cell];
+
+  b.pending.clear();
+  b.pendingCount = b.count;
+  b.tried = true;
+
+  b.offset.resize( b.size );
+  for(int n=0;n<b.size;n++)
+    b.offset[n] = std::make_pair( minimumImage( b.sample[n].first-ci ), minimumImage( b.sample[n].second-cj ) );
+
+  for(int n1=0;n1<b.size;n1++){
+    int ai = b.sample[n1].first;
+    int aj = b.sample[n1].second;
+    for(int n2=0;n2<b.size;n2++){
+      int bi = b.sample[n2].first;
+      int bj = b.sample[n2].second;
+
+      // The chunk only gives sites to trial.cell, so its lines can only
+      // come back inside and everyone else's can only go out; the others
+      // can't change and aren't walked.
+      char was = b.outside[ n1*b.capacity+n2 ];
+      if( was != (trial.cell==cell) )
+        continue;
+
+      if( lineNear( b.offset[n1].first, b.offset[n1].second,
+                    minimumImage(bi-ai), minimumImage(bj-aj), chunkSize ) ){
+        char now = leavesCell( cell, ai, aj, bi, bj, trial );
+        if( now != was ){
+          b.pending.push_back( std::make_pair( n1*b.capacity+n2, now ) );
+          b.pendingCount += now-was;
+        }
+      }
+    }
+  }
+
+  return blobularPenalty( cell, b.pendingCount );
+}
+
+/*******************************************************************************/
+/*** Keeps the flip: records the re-tested lines and drops stale samples ***/
+
+// Call once the perimeters have been adjusted, for every cell the chunk
+// touched, then call resampleBlobular() for each of them.  A cell that was not part of the
+// energy calculation (a third cell under a chunk) is re-tested here.
+
+void acceptBlobular(int cell, int ci, int cj)
+{
+  if(cell==0 || L_blb==0)
+    return;
+
+  blobularCache &b = blobular[cell];
+
+  if( !b.tried )
+    trialBlobularEnergy( cell, ci, cj, noChunk );
+
+  for(int n=0;n<(int)b.pending.size();n++)
+    b.outside[ b.pending[n].first ] = b.pending[n].second;
+  b.count = b.pendingCount;
+  b.pending.clear();
+  b.tried = false;
+
+  // Sampled sites that are no longer on this cell's perimeter
+
+  for(int i=ci-chunkSize-1;i<=ci+chunkSize+1;i++){
+    for(int j=cj-chunkSize-1;j<=cj+chunkSize+1;j++){
+      int x = (N+i)%N;
+      int y = (N+j)%N;
+      if( sampleSlot[x][y]>=0 && sampleCell[x][y]==cell &&
+          ( lattice[x][y][0]!=cell || !isPerimeter(x,y) ) )
+        removeSample( cell, sampleSlot[x][y] );
+    }
+  }
+}
+
+/*******************************************************************************/
+/*** Adds a cell's newly sampled perimeter sites around a kept flip ***/
+
+void resampleBlobular(int cell, int ci, int cj)
+{
+  if(cell==0 || L_blb==0)
+    return;
+
+  // The sample spacing follows log(perimeter); once it moves the whole
+  // sample changes, so start over
+
+  if( sampleSpacing( cellPerimeterList[cell].size(), blobular[cell].spacing )!=blobular[cell].spacing ){
+    buildBlobular(cell);
+    return;
+  }
+
+  for(int i=ci-chunkSize-1;i<=ci+chunkSize+1;i++){
+    for(int j=cj-chunkSize-1;j<=cj+chunkSize+1;j++){
+      int x = (N+i)%N;
+      int y = (N+j)%N;
+      if( lattice[x][y][0]==cell && sampleSlot[x][y]<0 && isPerimeter(x,y) &&
+          isSampled( x, y, blobular[cell].spacing ) )
+        addSample( cell, x, y );
+    }
+  }
+}
+
+/*******************************************************************************/
+/*** Forgets the re-tested lines of a rejected flip ***/
+
+void rejectBlobular(int cell)
+{
+  if(cell==0 || L_blb==0)
+    return;
+
+  blobular[cell].pending.clear();
+  blobular[cell].pendingCount = blobular[cell].count;
+  blobular[cell].tried = false;
+}
+
+/*******************************************************************************/
+/*** Debugging: compares a cell's cached count against a full recount ***/
+
+void checkBlobular(int cell)
+{
+  if(cell==0 || L_blb==0)
+    return;
+
+  int count = countBlobular(cell);
+
+  if( count!=blobular[cell].count )
+    printf("\nproblem: blobular count of cell %d is %d, should be %d",
+           cell, blobular[cell].count, count);
+}
+
+/*******************************************************************************/
+/*** Counts the sampled lines leaving a cell from scratch ***/
+
+int countBlobular(int cell)
+{
+  int spacing = blobular.empty() ? 0 : blobular[cell].spacing;
+  if(spacing==0)
+    spacing = sampleSpacing( cellPerimeterList[cell].size(), 0 );
+
+  std::vector< std::pair<int, int> > sample;
+  for(int n=0;n<(int)cellPerimeterList[cell].size();n++)
+    if( isSampled( cellPerimeterList[cell][n].first, cellPerimeterList[cell][n].second, spacing ) )
+      sample.push_back( cellPerimeterList[cell][n] );
+
+  int count = 0;
+  for(int n1=0;n1<(int)sample.size();n1++)
+    for(int n2=0;n2<(int)sample.size();n2++)
+      count += leavesCell( cell, sample[n1].first, sample[n1].second, sample[n2].first, sample[n2].second );
+
+  return count;
+}
+
+/*******************************************************************************/
+/*** Does the line from (ai,aj) to (bi,bj) leave the cell? ***/
+
+bool leavesCell(int cell, int ai, int aj, int bi, int bj)
+{
+  return leavesCell( cell, ai, aj, bi, bj, latticeView() );
+}
+
+template <class View> bool leavesCell(int cell, int ai, int aj, int bi, int bj, const View &view)
+{
+  int dx = minimumImage(bi-ai);
+  int sx = (dx>0)-(dx<0);
+  int dy = minimumImage(bj-aj);
+  int sy = (dy>0)-(dy<0);
+
+  // a vertical line takes all of its steps in the first column
+  double slope;
+  if(dx!=0)
+    slope = (double)dy/(double)dx;
+  else
+    slope = (double)dy;
+
+  int x = ai;
+  int y = aj;
+  double error = fabs(slope);
+
+  do{
+    if(view.at(x,y)!=cell)
+      return true;
+    while(error>0.5){
+      y=(y+sy+N)%N;
+      if(view.at(x,y)!=cell)
+        return true;
+      error=error-1.0;
+    }
+    x=(x+sx+N)%N;
+    error+=fabs(slope);
+  }while(x!=(ai+dx+N)%N);
+
+  return false;
+}
+
+/*******************************************************************************/
+/*** Could a line pass through the chunk? ***/
+
+// The line starts (ax,ay) away from the centre of the (2r+1)^2 chunk and
+// runs (dx,dy).  The walk in leavesCell() stays within a site of the
+// straight line, so this is conservative: only lines that pass further
+// than that from every chunk site are ruled out.
+
+bool lineNear(int ax, int ay, int dx, int dy, int r)
+{
+  double reach = 1.5*r+2.0;
+
+  // bounding box first
+  if( (dx<0 ? ax+dx : ax) > r+2 || (dx>0 ? ax+dx : ax) < -r-2 )
+    return false;
+  if( (dy<0 ? ay+dy : ay) > r+2 || (dy>0 ? ay+dy : ay) < -r-2 )
+    return false;
+
+  // then distance from the chunk centre (-ax,-ay) to the segment
+  double length2 = (double)(dx*dx+dy*dy);
+  if( length2==0.0 )
+    return (double)(ax*ax+ay*ay) <= reach*reach;
+
+  double along = -(double)(ax*dx+ay*dy);
+  if( along < -reach*sqrt(length2) || along > length2+reach*sqrt(length2) )
+    return false;
+
+  double cross = (double)(ax*dy-ay*dx);
+  return cross*cross <= reach*reach*length2;
+}
+
+/*******************************************************************************/
+/*** Shortest periodic displacement ***/
+
+// in [-N/2, N/2) for even N, and [-(N-1)/2, (N-1)/2] for odd N
+
+int minimumImage(int d)
+{
+  if( 2*d >= N )
+    return d-N;
+  if( 2*d < -N )
+    return d+N;
+  return d;
+}
+
+/*******************************************************************************/
+/*** Is a perimeter site part of the sample? ***/
+
+bool isSampled(int i, int j, int spacing)
+{
+  unsigned int h = (unsigned int)(i*N+j)*2654435761u;
+  return (h>>16)%spacing==0;
+}
+
+/*******************************************************************************/
+/*** Sample spacing for a perimeter length ***/
+
+// log(perimeter), but only moved once log(perimeter) is clearly past the
+// next integer, so a cell sitting on a boundary doesn't keep rebuilding
+
+int sampleSpacing(int perimeter, int current)
+{
+  double logP = log( (double)perimeter );
+
+  if( current>0 && logP>current-0.25 && logP<current+1.25 )
+    return current;
+
+  if( logP<1.0 )
+    return 1;
+  return (int)logP;
+}
+
+/*******************************************************************************/
+/*** Adds a site to a cell's sample, testing its lines to every other site ***/
+
+void addSample(int cell, int i, int j)
+{
+  blobularCache &b = blobular[cell];
+
+  if( b.size==b.capacity ){
+    int capacity = b.capacity<16 ? 16 : 2*b.capacity;
+    std::vector<char> outside( capacity*capacity, 0 );
+    for(int n1=0;n1<b.size;n1++)
+      for(int n2=0;n2<b.size;n2++)
+        outside[ n1*capacity+n2 ] = b.outside[ n1*b.capacity+n2 ];
+    b.outside.swap( outside );
+    b.capacity = capacity;
+  }
+
+  int k = b.size++;
+  b.sample.resize( b.size );
+  b.sample[k] = std::make_pair(i,j);
+  sampleSlot[i][j] = k;
+  sampleCell[i][j] = cell;
+
+  for(int n=0;n<=k;n++){
+    char out = leavesCell( cell, i, j, b.sample[n].first, b.sample[n].second );
+    b.outside[ k*b.capacity+n ] = out;
+    b.count += out;
+    if(n==k)
+      break;
+    out = leavesCell( cell, b.sample[n].first, b.sample[n].second, i, j );
+    b.outside[ n*b.capacity+k ] = out;
+    b.count += out;
+  }
+}
+
+/*******************************************************************************/
+/*** Drops sample n from a cell, moving the last sample into its place ***/
+
+void removeSample(int cell, int n)
+{
+  blobularCache &b = blobular[cell];
+  int last = b.size-1;
+  int cap = b.capacity;
+
+  for(int m=0;m<b.size;m++){
+    b.count -= b.outside[ n*cap+m ];
+    if(m!=n)
+      b.count -= b.outside[ m*cap+n ];
+  }
+
+  sampleSlot[ b.sample[n].first ][ b.sample[n].second ] = -1;
+
+  if( n!=last ){
+    for(int m=0;m<last;m++){
+      if(m==n)
+        continue;
+      b.outside[ n*cap+m ] = b.outside[ last*cap+m ];
+      b.outside[ m*cap+n ] = b.outside[ m*cap+last ];
+    }
+    b.outside[ n*cap+n ] = b.outside[ last*cap+last ];
+    b.sample[n] = b.sample[last];
+    sampleSlot[ b.sample[n].first ][ b.sample[n].second ] = n;
+  }
+
+  b.sample.pop_back();
+  b.size--;
+}
+
+/*******************************************************************************/
@@ -0,0 +1,278 @@
+#include <math.h>
+#include <utility>
+#include <vector>
+
+/*******************************************************************************/
+/*** CELL MEMBERSHIP FUNCTIONS ***/
+
+  void  initCells();
+  void  addVolume(int i, int j, int cell);
+  void  removeVolume(int i, int j, int cell);
+  void  addPerimeter(int i, int j, int cell);
+  void  removePerimeter(int i, int j, int cell);
+  void  clearPerimeter(int cell);
+  bool  isPerimeter(int i, int j);
+  void  addMoments(int i, int j, int cell, int sign);
+  void  centreMoments(int cell);
+  int   minimumImage(int d);
+
+  // the smallest box around a cell's sites, in the moments' unwrapping;
+  // stale once a site on its edge has gone, until cellBounds() asks
+
+  struct cellBox
+  {
+    int  xmin, xmax, ymin, ymax;
+    bool stale;
+  };
+
+  const cellBox &cellBounds(int cell);
+
+  // the sums over a cell's sites of x, y and their products, with x and
+  // y unwrapped around an anchor near the middle of the cell
+
+  struct cellMoments
+  {
+    int  ai, aj;                // the anchor
+    long n, sx, sy, sxx, syy, sxy;
+  };
+
+  std::vector<cellMoments> cellMoment;
+  std::vector<cellBox>     cellBoxes;
+
+  // Views of the lattice's upper layer, for the energies that can be
+  // worked out either way: as it is, or as it would be with a square of
+  // side sites from (i0,j0) on (wrapped) put in cell, without writing it.
+  // flip() works out the energy of a proposal through a chunkView.
+
+  struct latticeView
+  {
+    int at(int i, int j) const { return lattice[i][j][0]; }
+  };
+
+  struct chunkView
+  {
+    int i0, j0, side, cell;
+    int at(int i, int j) const;
+  };
+
+  const chunkView noChunk = { 0, 0, 0, 0 };   // nothing flipped
+
+/*
+    Each cell keeps its volume and perimeter sites in a dense array,
+    cellVolumeList[cell][n] and cellPerimeterList[cell][n], in no
+    particular order.  volumeSlot[i][j] and perimeterSlot[i][j] hold
+    the position of site (i,j) in the list of the cell it belongs to
+    (or -1), so membership tests, inserts and erases are all O(1):
+    an erased site is overwritten by the last site in the list.
+
+    Only ever change the lists through the functions below, otherwise
+    the slots go stale.
+
+    The same functions keep cellMoment[cell], the first and second
+    moments of the cell's sites, so the shape of a cell's second moments
+    (see momentAnisotropy() in potts_analysis_.h) is there in O(1).  The
+    sites are unwrapped around an anchor, which is moved back to the
+    middle of the cell (and the sums done over) whenever the middle has
+    wandered N/8 away from it, so a cell can get to 3N/4 across before
+    the unwrapping goes wrong.  The bounding box in cellBoxes[cell] only
+    ever grows as sites come in; losing a site on its edge leaves it to
+    be found again from the perimeter the next time it is asked for.
+*/
+
+/*******************************************************************************/
+/*** Empties every cell and sizes the lists for numCells ***/
+
+void initCells()
+{
+  cellVolumeList.assign( numCells+1, std::vector< std::pair<int, int> >() );
+  cellPerimeterList.assign( numCells+1, std::vector< std::pair<int, int> >() );
+  cellMoment.assign( numCells+1, cellMoments() );
+  cellBoxes.assign( numCells+1, cellBox() );
+
+  for(int cell=1;cell<=numCells;cell++){
+    cellVolumeList[cell].reserve( 2*(int)targetVolume );
+    cellPerimeterList[cell].reserve( 2*(int)(2.0*3.141593*cellRadius) );
+  }
+
+  for(int i=0;i<N;i++){
+    for(int j=0;j<N;j++){
+      volumeSlot[i][j] = -1;
+      perimeterSlot[i][j] = -1;
+    }
+  }
+}
+
+/*******************************************************************************/
+/*** Adds a site to / removes a site from a cell's volume ***/
+
+void addVolume(int i, int j, int cell)
+{
+  if(cell!=0 && volumeSlot[i][j]<0){
+    volumeSlot[i][j] = cellVolumeList[cell].size();
+    cellVolumeList[cell].push_back( std::make_pair(i,j) );
+    addMoments( i, j, cell, 1 );
+  }
+  return;
+}
+
+void removeVolume(int i, int j, int cell)
+{
+  int n = volumeSlot[i][j];
+
+  if(cell!=0 && n>=0 && n<(int)cellVolumeList[cell].size() && cellVolumeList[cell][n]==std::make_pair(i,j)){
+    std::pair<int, int> last = cellVolumeList[cell].back();
+    cellVolumeList[cell][n] = last;
+    volumeSlot[last.first][last.second] = n;
+    cellVolumeList[cell].pop_back();
+    volumeSlot[i][j] = -1;
+    addMoments( i, j, cell, -1 );
+  }
+  return;
+}
+
+/*******************************************************************************/
+/*** Adds a site to (sign 1) or takes it off (-1) a cell's moments ***/
+
+void addMoments(int i, int j, int cell, int sign)
+{
+  cellMoments &m = cellMoment[cell];
+  if(m.n==0){
+    m.ai = i;
+    m.aj = j;
+  }
+
+  long x = minimumImage(i-m.ai);
+  long y = minimumImage(j-m.aj);
+  m.n   += sign;
+  m.sx  += sign*x;
+  m.sy  += sign*y;
+  m.sxx += sign*x*x;
+  m.syy += sign*y*y;
+  m.sxy += sign*x*y;
+
+  cellBox &box = cellBoxes[cell];
+  if(sign>0 && m.n==1){
+    cellBox first = { (int)x, (int)x, (int)y, (int)y, false };
+    box = first;
+  }
+  else if(sign>0){
+    if(x<box.xmin) box.xmin = x;
+    if(x>box.xmax) box.xmax = x;
+    if(y<box.ymin) box.ymin = y;
+    if(y>box.ymax) box.ymax = y;
+  }
+  else if( x==box.xmin || x==box.xmax || y==box.ymin || y==box.ymax )
+    box.stale = true;
+
+  long reach = m.n*(N/8);
+  if( m.sx>reach || m.sx<-reach || m.sy>reach || m.sy<-reach )
+    centreMoments(cell);
+}
+
+// moves the anchor to the middle of the cell and sums the sites again
+
+void centreMoments(int cell)
+{
+  cellMoments &m = cellMoment[cell];
+  int ai = (N+m.ai+(int)lround((double)m.sx/m.n)%N)%N;
+  int aj = (N+m.aj+(int)lround((double)m.sy/m.n)%N)%N;
+
+  m = cellMoments();
+  m.ai = ai;
+  m.aj = aj;
+  for(int n=0;n<(int)cellVolumeList[cell].size();n++){
+    long x = minimumImage(cellVolumeList[cell][n].first-ai);
+    long y = minimumImage(cellVolumeList[cell][n].second-aj);
+    m.n++;
+    m.sx += x;
+    m.sy += y;
+    m.sxx += x*x;
+    m.syy += y*y;
+    m.sxy += x*y;
+  }
+  cellBoxes[cell].stale = true;
+}
+
+/*******************************************************************************/
+/*** A cell's bounding box, found again if it has gone stale ***/
+
+// the sites farthest out are on the perimeter, so that is all it looks at
+
+const cellBox &cellBounds(int cell)
+{
+  cellBox &box = cellBoxes[cell];
+  if(box.stale){
+    const cellMoments &m = cellMoment[cell];
+    cellBox empty = { N, -N, N, -N, false };
+    box = empty;
+    for(int n=0;n<(int)cellPerimeterList[cell].size();n++){
+      int x = minimumImage(cellPerimeterList[cell][n].first-m.ai);
+      int y = minimumImage(cellPerimeterList[cell][n].second-m.aj);
+      if(x<box.xmin) box.xmin = x;
+      if(x>box.xmax) box.xmax = x;
+      if(y<box.ymin) box.ymin = y;
+      if(y>box.ymax) box.ymax = y;
+    }
+  }
+  return box;
+}
+
+/*******************************************************************************/
+/*** Adds a site to / removes a site from a cell's perimeter ***/
+
+void addPerimeter(int i, int j, int cell)
+{
+  if(cell!=0 && perimeterSlot[i][j]<0){
+    perimeterSlot[i][j] = cellPerimeterList[cell].size();
+    cellPerimeterList[cell].push_back( std::make_pair(i,j) );
+  }
+  return;
+}
+
+void removePerimeter(int i, int j, int cell)
+{
+  int n = perimeterSlot[i][j];
+
+  if(cell!=0 && n>=0 && n<(int)cellPerimeterList[cell].size() && cellPerimeterList[cell][n]==std::make_pair(i,j)){
+    std::pair<int, int> last = cellPerimeterList[cell].back();
+    cellPerimeterList[cell][n] = last;
+    perimeterSlot[last.first][last.second] = n;
+    cellPerimeterList[cell].pop_back();
+    perimeterSlot[i][j] = -1;
+  }
+  return;
+}
+
+/*******************************************************************************/
+/*** Empties a cell's perimeter ***/
+
+void clearPerimeter(int cell)
+{
+  for(int n=0;n<(int)cellPerimeterList[cell].size();n++)
+    perimeterSlot[ cellPerimeterList[cell][n].first ][ cellPerimeterList[cell][n].second ] = -1;
+  cellPerimeterList[cell].clear();
+}
+
+/*******************************************************************************/
+/*** Is the site on the perimeter of the cell it belongs to? ***/
+
+bool isPerimeter(int i, int j)
+{
+  return perimeterSlot[i][j]>=0;
+}
+
+/*******************************************************************************/
+/*** The cell at a site, as seen through a view ***/
+
+int chunkView::at(int i, int j) const
+{
+  int di = i-i0;
+  int dj = j-j0;
+  if(di<0)
+    di += N;
+  if(dj<0)
+    dj += N;
+  return di<side && dj<side ? cell : lattice[i][j][0];
+}
+
+/*******************************************************************************/
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*******************************************************************************/
+/*** CHECKPOINT FUNCTIONS ***/
+
+  void  writeCheckpoint(const char *dname, int loop);
+  bool  readCheckpoint(const char *fname, std::vector<char> &buf);
+  void  resumeParameters(const char *dname);
+  int   resumeState(const char *dname);
+  void  trimEnergies(const char *fname, int lines);
+  void  putBytes(std::vector<char> &buf, const void *data, size_t size);
+  bool  getBytes(const char *&p, const char *end, void *data, size_t size);
+
+/*
+    Every CHECKPOINT loops the whole state of the run goes to
+    aaa_checkpoint_.bin in the output directory:
+
+      "PCKP", version
+      the parameters, as config text ("KEY\tvalue" lines, doubles to
+      17 digits so they read back exactly)
+      loop, totalEnergy, avg, dev
+      the lattice, both layers
+      every cell's volume and perimeter list, in order
+      every cell's blobular sample spacing
+      every random stream
+      the run statistics (see potts_stats_.h)
+      the n-fold way's wait (see potts_nfold_.h)
+
+    potts -r directory [KEY=value ...] picks the run up from there, and
+    carries on exactly as it would have without stopping (with THREADS 1;
+    parallel sweeps aren't repeatable to begin with).  LOOPS can be
+    raised on the command line to run longer.  The energy trace is cut
+    back to the checkpoint, lattices past it are written over.
+
+    The order of the cell lists matters, since flips are chosen by
+    position in the perimeter list, so they are stored as they are
+    rather than rebuilt.  The blobular caches are rebuilt, which only
+    needs the sample spacing: the line count of a set of samples doesn't
+    depend on their order.
+
+    The checkpoint goes through the writer thread behind the energy
+    lines before it, and like every whole file it is written to a
+    temporary and renamed, so a run killed halfway leaves the last
+    complete checkpoint behind.
+*/
+
+/*******************************************************************************/
+/*** Writes the state after loop to the checkpoint ***/
+
+void writeCheckpoint(const char *dname, int loop)
+{
+  std::vector<char> buf;
+  char fname[400];
+  char line[200];
+  int  version = 1;
+
+  buf.reserve( 8*N*N+64*1024 );
+  putBytes( buf, "PCKP", 4 );
+  putBytes( buf, &version, sizeof(version) );
+
+  std::string params;
+  for(int n=0;n<numConfig;n++){
+    if(config[n].type=='d')
+      sprintf(line,"%s\t%.17g\n",config[n].key,*(double*)config[n].value);
+    else
+      sprintf(line,"%s\t%d\n",config[n].key,*(int*)config[n].value);
+    params += line;
+  }
+  int length = params.size();
+  putBytes( buf, &length, sizeof(length) );
+  putBytes( buf, params.data(), length );
+
+  putBytes( buf, &loop, sizeof(loop) );
+  putBytes( buf, &totalEnergy, sizeof(totalEnergy) );
+  putBytes( buf, avg, sizeof(avg) );
+  putBytes( buf, dev, sizeof(dev) );
+
+  for(int i=0;i<N;i++)
+    putBytes( buf, lattice[i], N*sizeof(lattice[i][0]) );
+
+  for(int cell=0;cell<=numCells;cell++){
+    for(int list=0;list<2;list++){
+      std::vector< std::pair<int, int> > &sites = list==0 ? cellVolumeList[cell] : cellPerimeterList[cell];
+      int size = sites.size();
+      putBytes( buf, &size, sizeof(size) );
+      for(int n=0;n<size;n++){
+        putBytes( buf, &sites[n].first, sizeof(int) );
+        putBytes( buf, &sites[n].second, sizeof(int) );
+      }
+    }
+  }
+
+  for(int cell=1;cell<=numCells;cell++)
+    putBytes( buf, &blobular[cell].spacing, sizeof(int) );
+
+  int streams = threadStreams.size();
+  int streamSize = sizeof(randomStream);
+  putBytes( buf, &streams, sizeof(streams) );
+  putBytes( buf, &streamSize, sizeof(streamSize) );
+  putBytes( buf, &mainStream, sizeof(randomStream) );
+  for(int t=0;t<streams;t++)
+    putBytes( buf, &threadStreams[t], sizeof(randomStream) );
+
+  int observables = STATS_OBSERVABLES;
+  int statsSize = sizeof(runningStats);
+  putBytes( buf, &observables, sizeof(observables) );
+  putBytes( buf, &statsSize, sizeof(statsSize) );
+  putBytes( buf, runStats, sizeof(runStats) );
+
+  putBytes( buf, &nfoldWait, sizeof(nfoldWait) );
+
+  sprintf(fname,"%s/aaa_checkpoint_.bin",dname);
+  writeOutput( fname, &buf[0], buf.size(), false );
+}
+
+/*******************************************************************************/
+/*** Reads a checkpoint, returns false if it isn't one ***/
+
+bool readCheckpoint(const char *fname, std::vector<char> &buf)
+{
+  FILE* inFile=fopen(fname,"rb");
+  if(inFile==NULL)
+    return false;
+
+  char block[65536];
+  size_t got;
+  buf.clear();
+  while( (got=fread(block,1,sizeof(block),inFile))>0 )
+    buf.insert( buf.end(), block, block+got );
+  fclose(inFile);
+
+  int version;
+  if( buf.size()<8 || memcmp(&buf[0],"PCKP",4)!=0 )
+    return false;
+  memcpy( &version, &buf[4], sizeof(version) );
+  return version==1;
+}
+
+/*******************************************************************************/
+/*** Takes the parameters of the run in dname ***/
+
+// Called while reading the command line, so that whatever follows -r
+// can still change them.
+
+void resumeParameters(const char *dname)
+{
+  std::vector<char> buf;
+  char fname[400];
+
+  sprintf(fname,"%s/aaa_checkpoint_.bin",dname);
+  if( !readCheckpoint(fname,buf) ){
+    printf("\n Nope... no checkpoint in %s\n\n",dname);
+    exit(1);
+  }
+
+  int length;
+  memcpy( &length, &buf[8], sizeof(length) );
+  if( length<0 || (size_t)length>buf.size()-12 ){
+    printf("\n Nope... the checkpoint in %s is damaged\n\n",dname);
+    exit(1);
+  }
+  std::string params( &buf[12], length );
+
+  char *line = strtok( &params[0], "\n" );
+  while(line!=NULL){
+    char *value = strchr(line,'\t');
+    if(value!=NULL){
+      *value++ = '\0';
+      setConfig(line,value);
+    }
+    line = strtok( NULL, "\n" );
+  }
+
+  strncpy( resumeDir, dname, sizeof(resumeDir)-1 );
+}
+
+/*******************************************************************************/
+/*** Puts the state of the run in dname back, returns the loop it was at ***/
+
+// The cells must have been set up with initCells() and the random
+// streams with initRandom(); the blobular caches are built here.
+
+int resumeState(const char *dname)
+{
+  std::vector<char> buf;
+  char fname[400];
+
+  sprintf(fname,"%s/aaa_checkpoint_.bin",dname);
+  if( !readCheckpoint(fname,buf) ){
+    printf("\n Nope... no checkpoint in %s\n\n",dname);
+    exit(1);
+  }
+
+  const char *p = &buf[8];
+  const char *end = &buf[0]+buf.size();
+  int length, loop;
+  bool ok = true;
+
+  ok = ok && getBytes( p, end, &length, sizeof(length) );
+  p += length;
+  ok = ok && getBytes( p, end, &loop, sizeof(loop) );
+  ok = ok && getBytes( p, end, &totalEnergy, sizeof(totalEnergy) );
+  ok = ok && getBytes( p, end, avg, sizeof(avg) );
+  ok = ok && getBytes( p, end, dev, sizeof(dev) );
+
+  for(int i=0;i<N && ok;i++)
+    ok = getBytes( p, end, lattice[i], N*sizeof(lattice[i][0]) );
+
+  for(int cell=0;cell<=numCells && ok;cell++){
+    for(int list=0;list<2 && ok;list++){
+      int size;
+      ok = getBytes( p, end, &size, sizeof(size) ) && size>=0 && size<=N*N;
+      for(int n=0;n<size && ok;n++){
+        int i,j;
+        ok = getBytes( p, end, &i, sizeof(i) ) && getBytes( p, end, &j, sizeof(j) ) &&
+             i>=0 && i<N && j>=0 && j<N;
+        if(ok && list==0)
+          addVolume( i, j, cell );
+        if(ok && list==1)
+          addPerimeter( i, j, cell );
+      }
+    }
+  }
+
+  initBlobular();
+  for(int cell=1;cell<=numCells && ok;cell++){
+    int spacing;
+    ok = getBytes( p, end, &spacing, sizeof(spacing) );
+    if(ok && L_blb==0)
+      blobular[cell].spacing = spacing;   // not kept up, see potts_blobular_.h
+    else if(ok && spacing!=blobular[cell].spacing){
+      blobular[cell].spacing = spacing;
+      buildBlobular(cell);
+    }
+  }
+
+  int streams, streamSize;
+  ok = ok && getBytes( p, end, &streams, sizeof(streams) ) && getBytes( p, end, &streamSize, sizeof(streamSize) );
+  if( ok && streams!=(int)threadStreams.size() ){
+    printf("\n Nope... %s was run with %d threads\n\n",dname,streams);
+    exit(1);
+  }
+  ok = ok && streamSize==(int)sizeof(randomStream);
+  ok = ok && getBytes( p, end, &mainStream, sizeof(randomStream) );
+  for(int t=0;t<streams && ok;t++)
+    ok = getBytes( p, end, &threadStreams[t], sizeof(randomStream) );
+
+  int observables, statsSize;
+  ok = ok && getBytes( p, end, &observables, sizeof(observables) ) && getBytes( p, end, &statsSize, sizeof(statsSize) );
+  ok = ok && observables==STATS_OBSERVABLES && statsSize==(int)sizeof(runningStats);
+  ok = ok && getBytes( p, end, runStats, sizeof(runStats) );
+
+  ok = ok && getBytes( p, end, &nfoldWait, sizeof(nfoldWait) );
+
+  if(!ok){
+    printf("\n Nope... the checkpoint in %s is damaged\n\n",dname);
+    exit(1);
+  }
+
+  return loop;
+}
+
+/*******************************************************************************/
+/*** Cuts a text file back to its first so many lines ***/
+
+// The lines are counted by their '\n', a block at a time, since a line
+// of aaa_shapes_.txt or aaa_contacts_.txt grows with the cells.
+
+void trimEnergies(const char *fname, int lines)
+{
+  std::string text;
+  char block[4096];
+  size_t size;
+
+  FILE* inFile=fopen(fname,"rb");
+  if(inFile==NULL)
+    return;
+  while( lines>0 && (size=fread(block,1,sizeof(block),inFile))>0 ){
+    size_t end = 0;
+    while( end<size && lines>0 )
+      if(block[end++]=='\n')
+        lines--;
+    text.append( block, end );
+  }
+  fclose(inFile);
+
+  writeOutput( fname, text.data(), text.size(), false );
+}
+
+/*******************************************************************************/
+/*** Raw bytes in and out of a buffer ***/
+
+void putBytes(std::vector<char> &buf, const void *data, size_t size)
+{
+  buf.insert( buf.end(), (const char*)data, (const char*)data+size );
+}
+
+bool getBytes(const char *&p, const char *end, void *data, size_t size)
+{
+  if( (size_t)(end-p)<size )
+    return false;
+  memcpy( data, p, size );
+  p += size;
+  return true;
+}
+
+/*******************************************************************************/
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*******************************************************************************/
+/*** CONFIGURATION FUNCTIONS ***/
+
+  struct configEntry
+  {
+    const char *key;   // as printed in aaa_log_.txt
+    char        type;  // 'i'nt, 'd'ouble, or 'N' for the lattice edge
+    void       *value;
+  };
+
+  void  readArguments(int argc, char *argv[], char *dname);
+  void  loadConfig(const char *fname);
+  bool  setConfig(const char *key, const char *value);
+  void  applyConfig();
+  void  resumeParameters(const char *dname);
+
+  char  batchFile[100] = "";   // -b, see potts_batch_.h
+  char *exportFrom = NULL;     // -x, see potts_snapshot_.h
+  char *exportTo = NULL;
+  char  resumeDir[100] = "";   // -r, see potts_checkpoint_.h
+
+/*
+    Every run-time parameter, under the name printLog() gives it, so the
+    aaa_log_.txt of one run can be handed back in as the config of the
+    next.  Config files have one "KEY <tabs> value" per line; on the
+    command line the same is written KEY=value, with _ for spaces.
+    Keys that aren't in the table (like ADVANCEAMOUNT) are ignored.
+*/
+
+  configEntry config[] = {
+    { "SEED",           'i', &seed },
+    { "LOOPS",          'i', &numLoops },
+    { "FLIPS",          'i', &numFlips },
+    { "PRINT",          'i', &numPrint },
+    { "CHECKPOINT",     'i', &checkpointEvery },
+    { "SNAPSHOT",       'i', &snapshotFormat },
+    { "OUTPUT QUEUE",   'i', &outputQueue },
+    { "CHUNKSIZE",      'i', &chunkSize },
+    { "THREADS",        'i', &numThreads },
+    { "REPLICAS",       'i', &numReplicas },
+    { "BETA",           'd', &beta },
+    { "BETA MAX",       'd', &betaMax },
+    { "SWAP EVERY",     'i', &swapEvery },
+    { "ACCEPTANCE",     'i', &acceptance },
+    { "ENGINE",         'i', &engine },
+    { "AIR",            'd', &J_air },
+    { "CELL",           'd', &J_cel },
+    { "COLLAGEN",       'd', &J_col },
+    { "VOLUME",         'd', &L_vol },
+    { "ANISOTROPY",     'd', &L_ani },
+    { "ANISOTROPY MEASURE", 'i', &anisotropyMeasure },
+    { "BLOBULAR",       'd', &L_blb },
+    { "LATTICE EDGE",   'N', (void*)&N },
+    { "NUM CELLS",      'i', &numCells },
+    { "NUM COLLAGEN",   'i', &numCollagen },
+    { "CELL SPAWN",     'd', &cellSpawn },
+    { "SPAWN",          'i', &spawnPacking },
+    { "CELL RADIUS",    'd', &cellRadius },
+    { "COLLAGEN WIDTH", 'i', &collagenWidth },
+  };
+
+  const int numConfig = sizeof(config)/sizeof(config[0]);
+
+/*******************************************************************************/
+/*** Reads the command line ***/
+
+/*
+    potts [directory [L_blb [anything]]] [-c config] [KEY=value ...]
+          [-b batch] [-j jobs]
+    potts -x snapshot text
+    potts -r directory [KEY=value ...]
+
+    The first plain argument is the output directory, the second the
+    blobular penalty, and a third turns printing off, as always.  Config
+    files and KEY=value pairs are applied in the order given, so later
+    ones win.  dname is left alone if no directory is given.
+*/
+
+void readArguments(int argc, char *argv[], char *dname)
+{
+  int positional = 0;
+
+  for(int n=1;n<argc;n++){
+    if( strcmp(argv[n],"-c")==0 && n+1<argc ){
+      loadConfig( argv[++n] );
+    }
+    else if( strcmp(argv[n],"-b")==0 && n+1<argc ){
+      strncpy( batchFile, argv[++n], sizeof(batchFile)-1 );
+    }
+    else if( strcmp(argv[n],"-j")==0 && n+1<argc ){
+      numJobs = atoi( argv[++n] );
+    }
+    else if( strcmp(argv[n],"-r")==0 && n+1<argc ){
+      resumeParameters( argv[++n] );
+      strcpy(dname,resumeDir);
+    }
+    else if( strcmp(argv[n],"-x")==0 && n+2<argc ){
+      exportFrom = argv[++n];
+      exportTo = argv[++n];
+    }
+    else if( strchr(argv[n],'=')!=NULL ){
+      char key[100];
+      strncpy( key, argv[n], sizeof(key)-1 );
+      key[sizeof(key)-1] = '\0';
+      char *value = strchr(key,'=');
+      *value++ = '\0';
+      for(char *c=key; *c; c++)
+        if(*c=='_')
+          *c = ' ';
+      if( !setConfig(key,value) ){
+        printf("\n Nope... no parameter called %s\n\n",key);
+        exit(1);
+      }
+    }
+    else{
+      if(positional==0)
+        strcpy(dname,argv[n]);
+      else if(positional==1)
+        L_blb = atof(argv[n]);
+      else
+        doPrinting = false;
+      positional++;
+    }
+  }
+}
+
+/*******************************************************************************/
+/*** Reads a config file ***/
+
+void loadConfig(const char *fname)
+{
+  char line[200];
+
+  FILE* inFile=fopen(fname,"r");
+  if(inFile==NULL){
+    printf("\n Nope... missing %s\n\n",fname);
+    exit(1);
+  }
+
+  while( fgets(line,sizeof(line),inFile)!=NULL ){
+
+    // the key runs up to the first tab, the value follows the last one
+    char *value = strrchr(line,'\t');
+    char *end = strchr(line,'\t');
+    if(value==NULL || line[0]=='#')
+      continue;
+    *end = '\0';
+    value++;
+
+    setConfig(line,value);
+  }
+
+  fclose(inFile);
+}
+
+/*******************************************************************************/
+/*** Sets one parameter, returns false if there is no such parameter ***/
+
+bool setConfig(const char *key, const char *value)
+{
+  for(int n=0;n<numConfig;n++){
+    if( strcmp(key,config[n].key)!=0 )
+      continue;
+
+    switch(config[n].type){
+      case 'i':
+        *(int*)config[n].value = atoi(value);
+        break;
+      case 'd':
+        *(double*)config[n].value = atof(value);
+        break;
+      case 'N':
+        #if LATTICE_EDGE
+        if( atoi(value)!=N ){
+          printf("\n Nope... compiled for a lattice edge of %d, not %d\n\n",N,atoi(value));
+          exit(1);
+        }
+        #else
+        N = atoi(value);
+        #endif
+        break;
+    }
+    return true;
+  }
+  return false;
+}
+
+/*******************************************************************************/
+/*** Works out what follows from the parameters and sizes the lattice ***/
+
+void applyConfig()
+{
+  if(numPrint<=0)
+    numPrint = numLoops/100;
+  if(numPrint<=0)
+    numPrint = 1;
+
+  if(checkpointEvery==0)
+    checkpointEvery = numLoops/10;
+  if(checkpointEvery==0)
+    checkpointEvery = 1;
+
+  if(numThreads<1)
+    numThreads = 1;
+
+  if(chunkSize<0 || chunkSize>MAX_CHUNK){
+    printf("\n Nope... compiled for a CHUNKSIZE of 0 to %d, not %d\n\n",MAX_CHUNK,chunkSize);
+    exit(1);
+  }
+
+  if(anisotropyMeasure<0 || anisotropyMeasure>1){
+    printf("\n Nope... there is no ANISOTROPY MEASURE %d\n\n",anisotropyMeasure);
+    exit(1);
+  }
+  if(engine<0 || engine>1){
+    printf("\n Nope... there is no ENGINE %d\n\n",engine);
+    exit(1);
+  }
+  if(engine==1 && (chunkSize!=0 || numThreads>1)){
+    printf("\n Nope... ENGINE 1 only runs with CHUNKSIZE 0 and THREADS 1\n\n");
+    exit(1);
+  }
+
+  targetVolume = 3.141593*cellRadius*cellRadius;
+
+  lattice.allocate();
+  volumeSlot.allocate();
+  perimeterSlot.allocate();
+}
+
+/*******************************************************************************/
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*******************************************************************************/
+/*** CELL CONTACT FUNCTIONS ***/
+
+  void  initContacts();
+  void  moveContacts(int i, int j, int oldCell, int newCell);
+  void  addContact(int a, int b, int bonds);
+  void  changeContact(int a, int b, int bonds);
+  int   contactLength(int a, int b);
+  void  checkContacts();
+  void  writeContacts(const char *fname, int loop);
+
+  // every cell's neighbours (0 for air) and the bonds it shares with each
+  std::vector< std::vector< std::pair<int, int> > > cellContacts;
+
+/*
+    Which cells touch which, and along how much boundary: a contact
+    between cells a and b has a length, the number of lattice bonds
+    with a on one end and b on the other.  cellContacts[a] lists every
+    cell a touches with that length, air (0) included, so a cell's free
+    surface is its contact with 0; air keeps no list of its own.
+
+    A flip only changes the bonds of the sites it flips, so
+    moveContacts() keeps the lists up in O(1) a site, from commitFlip().
+    With thousands of cells that is the only way to know who neighbours
+    whom without going over the lattice, and the lists are short (a
+    cell in a tissue touches about six others).
+
+    The graph goes to aaa_contacts_.txt with every lattice printed, a
+    line of
+
+      loop  a-b:length ...   (for every pair with a < b, then a-0)
+
+    in order, whatever order the lists happen to be in.
+
+    CHECK_PERIMETERS compares it against a count from scratch, after
+    every flip, or after every loop with THREADS more than 1 (the count
+    goes over the whole lattice, which other threads are flipping).
+*/
+
+/*******************************************************************************/
+/*** Counts every contact from the lattice ***/
+
+void initContacts()
+{
+  cellContacts.assign( numCells+1, std::vector< std::pair<int, int> >() );
+
+  // every bond once, going down and right
+  for(int i=0;i<N;i++)
+    for(int j=0;j<N;j++){
+      int site = lattice[i][j][0];
+      int down = lattice[(i+1)%N][j][0];
+      int right = lattice[i][(j+1)%N][0];
+      if(site!=down)
+        addContact( site, down, 1 );
+      if(site!=right)
+        addContact( site, right, 1 );
+    }
+}
+
+/*******************************************************************************/
+/*** Site (i,j) has just gone from oldCell to newCell ***/
+
+// the lattice has to hold newCell already, and every neighbour its
+// cell as of now
+
+void moveContacts(int i, int j, int oldCell, int newCell)
+{
+  if(oldCell==newCell)
+    return;
+
+  int neighbours[4] = { lattice[(i+1)%N][j][0], lattice[(N+i-1)%N][j][0],
+                        lattice[i][(j+1)%N][0], lattice[i][(N+j-1)%N][0] };
+  for(int d=0;d<4;d++){
+    if(neighbours[d]!=oldCell)
+      addContact( oldCell, neighbours[d], -1 );
+    if(neighbours[d]!=newCell)
+      addContact( newCell, neighbours[d], 1 );
+  }
+}
+
+/*******************************************************************************/
+/*** Adds bonds to the contact between a and b, both ways ***/
+
+void addContact(int a, int b, int bonds)
+{
+  if(a!=0)
+    changeContact( a, b, bonds );
+  if(b!=0)
+    changeContact( b, a, bonds );
+}
+
+// a's side only; a contact down to no bonds is taken off the list
+
+void changeContact(int a, int b, int bonds)
+{
+  std::vector< std::pair<int, int> > &list = cellContacts[a];
+  for(int n=0;n<(int)list.size();n++){
+    if(list[n].first!=b)
+      continue;
+    list[n].second += bonds;
+    if(list[n].second==0){
+      list[n] = list.back();
+      list.pop_back();
+    }
+    return;
+  }
+  list.push_back( std::make_pair(b,bonds) );
+}
+
+/*******************************************************************************/
+/*** The number of bonds between a and b ***/
+
+int contactLength(int a, int b)
+{
+  if(a==0){
+    a = b;
+    b = 0;
+  }
+  if(a==0)
+    return 0;
+  for(int n=0;n<(int)cellContacts[a].size();n++)
+    if(cellContacts[a][n].first==b)
+      return cellContacts[a][n].second;
+  return 0;
+}
+
+/*******************************************************************************/
+/*** Debugging: compares every contact against a count from scratch ***/
+
+void checkContacts()
+{
+  std::vector< std::vector< std::pair<int, int> > > kept;
+  kept.swap( cellContacts );
+  initContacts();
+
+  for(int a=1;a<=numCells;a++){
+    bool same = kept[a].size()==cellContacts[a].size();
+    for(int n=0; same && n<(int)kept[a].size(); n++)
+      same = contactLength( a, kept[a][n].first )==kept[a][n].second;
+    if(!same)
+      printf("\nproblem: contacts of cell %d are off",a);
+  }
+
+  cellContacts.swap( kept );
+}
+
+/*******************************************************************************/
+/*** Adds the contact graph to aaa_contacts_.txt ***/
+
+void writeContacts(const char *fname, int loop)
+{
+  char   line[64];
+  int    length;
+  std::string text;
+
+  length = sprintf(line,"%5d ",loop);
+  text.append( line, length );
+  for(int a=1;a<=numCells;a++){
+    std::vector< std::pair<int, int> > sorted( cellContacts[a] );
+    std::sort( sorted.begin(), sorted.end() );
+    for(int n=0;n<(int)sorted.size();n++)
+      if(sorted[n].first>a)
+        text.append( line, sprintf(line," %d-%d:%d",a,sorted[n].first,sorted[n].second) );
+  }
+  for(int a=1;a<=numCells;a++){
+    int free = contactLength( a, 0 );
+    if(free>0)
+      text.append( line, sprintf(line," %d-0:%d",a,free) );
+  }
+  text += '\n';
+  writeOutput( fname, text.data(), text.size(), true );
+}
+
+/*******************************************************************************/
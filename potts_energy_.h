@@ -1,5 +1,5 @@
 /*******************************************************************************/
-#include <set>
+#include <vector>
 #include <utility>
 
 //#include "potts_analysis_.h"
@@ -8,42 +8,82 @@
 
   double  inplaneEnergy(int,int);
   double  outplaneEnergy(int,int);
+  template <class View> double inplaneEnergy(int,int,const View&);
+  template <class View> double outplaneEnergy(int,int,const View&);
   double  Hamiltonian();
   double  interactionEnergy(int);
   double  volumeEnergy(int);
+  double  volumePenalty(int);
   double  anisotropyEnergy(int);
+  double  trialAnisotropyEnergy(int, const chunkView&);
   double  blobularEnergy(int);
 
   double measureAnisotropy( int );
+  double measureAnisotropy( int, const chunkView& );
+  void   shapeChanged( int );
+
+  struct cellEnergy
+  {
+    double volume;
+    double blobular;
+    double anisotropy;
+  };
+
+  void    initCellEnergies();
+  void    updateCellEnergy(int);
+  void    checkCellEnergy(int);
+
+  std::vector<cellEnergy> cellEnergies;
+
+/*
+    cellEnergies[cell] holds the volume, blobular and anisotropy energy of every cell
+    as it stands, so a flip takes its "before" energies from there instead
+    of working them out again.  The "after" energies of a proposal are
+    only kept in the flip; the table is written when the flip is accepted
+    (updateCellEnergy, once the perimeters and blobular caches are up to
+    date), so a rejected flip has nothing to undo.
+*/
 
 /*******************************************************************************/
 /*** Returns the in-plane interaction energy of a lattice site ****/
 
 double inplaneEnergy(int a, int b)
+{
+  return inplaneEnergy( a, b, latticeView() );
+}
+
+// the same, with the lattice as a view has it
+
+template <class View> double inplaneEnergy(int a, int b, const View &view)
 {
   double energy = 0.0;
 
-  if( lattice[a][b][0] != 0 ){
-    if( lattice[a][b][0] != lattice[(a+1)%N][b][0] ){
-      if( lattice[(a+1)%N][b][0] > 0 )
+  int site = view.at(a,b);
+  if( site != 0 ){
+    int neighbor = view.at((a+1)%N,b);
+    if( site != neighbor ){
+      if( neighbor > 0 )
         return J_cel;
       else
         energy = J_air;
     }
-    if( lattice[a][b][0] != lattice[(N+a-1)%N][b][0] ){
-      if( lattice[(N+a-1)%N][b][0] > 0 )
+    neighbor = view.at((N+a-1)%N,b);
+    if( site != neighbor ){
+      if( neighbor > 0 )
         return J_cel;
       else
         energy = J_air;
     }
-    if( lattice[a][b][0] != lattice[a][(b+1)%N][0] ){
-      if( lattice[a][(b+1)%N][0] > 0 )
+    neighbor = view.at(a,(b+1)%N);
+    if( site != neighbor ){
+      if( neighbor > 0 )
         return J_cel;
       else
         energy = J_air;
     }
-    if( lattice[a][b][0] != lattice[a][(N+b-1)%N][0] ){
-      if( lattice[a][(N+b-1)%N][0] > 0 )
+    neighbor = view.at(a,(N+b-1)%N);
+    if( site != neighbor ){
+      if( neighbor > 0 )
         return J_cel;
       else
         return J_air;
@@ -58,7 +98,12 @@ double inplaneEnergy(int a, int b)
 
 double outplaneEnergy(int a, int b)
 {
-  if( lattice[a][b][0]!=0 && lattice[a][b][1]!=0 )
+  return outplaneEnergy( a, b, latticeView() );
+}
+
+template <class View> double outplaneEnergy(int a, int b, const View &view)
+{
+  if( view.at(a,b)!=0 && lattice[a][b][1]!=0 )
     return J_col;
   else
     return 0.0;
@@ -69,9 +114,8 @@ double outplaneEnergy(int a, int b)
 
 double Hamiltonian()
 {
-  double energy = 0.0;
+  double energy = latticeInteractionEnergy();
   for(int cell=1;cell<=numCells;cell++){
-    energy += interactionEnergy(cell);
     energy += volumeEnergy(cell);
     energy += anisotropyEnergy(cell);
     energy += blobularEnergy(cell);
@@ -79,18 +123,57 @@ double Hamiltonian()
   return energy;
 }
 
+/*******************************************************************************/
+/*** Fills the table of per-cell energies ***/
+
+void initCellEnergies()
+{
+  cellEnergies.assign( numCells+1, cellEnergy() );
+  for(int cell=1;cell<=numCells;cell++)
+    updateCellEnergy(cell);
+}
+
+/*******************************************************************************/
+/*** Brings a cell's entry up to date after an accepted flip ***/
+
+void updateCellEnergy(int cell)
+{
+  if(cell==0)
+    return;
+  cellEnergies[cell].volume = volumeEnergy(cell);
+  cellEnergies[cell].blobular = cachedBlobularEnergy(cell);
+  cellEnergies[cell].anisotropy = anisotropyEnergy(cell);
+  shapeChanged(cell);
+}
+
+/*******************************************************************************/
+/*** Debugging: compares a cell's entry against the energies themselves ***/
+
+void checkCellEnergy(int cell)
+{
+  if(cell==0)
+    return;
+  if( cellEnergies[cell].volume!=volumeEnergy(cell) || cellEnergies[cell].blobular!=cachedBlobularEnergy(cell) ||
+      cellEnergies[cell].anisotropy!=anisotropyEnergy(cell) )
+    printf("\nproblem: energies of cell %d are %lf %lf %lf, should be %lf %lf %lf",cell,
+           cellEnergies[cell].volume,cellEnergies[cell].blobular,cellEnergies[cell].anisotropy,
+           volumeEnergy(cell),cachedBlobularEnergy(cell),anisotropyEnergy(cell));
+}
+
 /*******************************************************************************/
 /*** Returns the interaction energy of a cell ****/
 
+// Hamiltonian() takes all of them at once with latticeInteractionEnergy()
+
 double interactionEnergy(int cell)
 {
   double energy = 0.0;
 
-  for(std::set< std::pair<int, int> >::iterator it = cellPerimeterList[cell].begin(); it!=cellPerimeterList[cell].end(); ++it)
-	  energy += inplaneEnergy( it->first , it-> second );
+  for(int n=0; n<(int)cellPerimeterList[cell].size(); n++)
+	  energy += inplaneEnergy( cellPerimeterList[cell][n].first , cellPerimeterList[cell][n].second );
 
-  for(std::set< std::pair<int, int> >::iterator it = cellVolumeList[cell].begin(); it!=cellVolumeList[cell].end(); ++it)
-	  energy += outplaneEnergy( it->first , it-> second );
+  for(int n=0; n<(int)cellVolumeList[cell].size(); n++)
+	  energy += outplaneEnergy( cellVolumeList[cell][n].first , cellVolumeList[cell][n].second );
 
   return energy;
 }
@@ -100,7 +183,14 @@ double interactionEnergy(int cell)
 
 double volumeEnergy(int cell)
 {
-  return L_vol*((double)cellVolumeList[cell].size()-targetVolume)*((double)cellVolumeList[cell].size()-targetVolume);
+  return volumePenalty( cellVolumeList[cell].size() );
+}
+
+// the volume energy of a cell of the given volume
+
+double volumePenalty(int volume)
+{
+  return L_vol*((double)volume-targetVolume)*((double)volume-targetVolume);
 }
 
 /*******************************************************************************/
@@ -109,7 +199,18 @@ double volumeEnergy(int cell)
 double anisotropyEnergy(int cell)
 {
 	//	return L_ani*(double)cellPerimeterList[cell].size()/(double)cellVolumeList[cell].size();
-		return L_ani*measureAnisotropy( cell );
+	if( L_ani==0.0 )
+		return 0.0;
+	return L_ani*measureAnisotropy( cell );
+}
+
+// the same, as the cell would be after the trial flip
+
+double trialAnisotropyEnergy(int cell, const chunkView &trial)
+{
+	if( L_ani==0.0 )
+		return 0.0;
+	return L_ani*measureAnisotropy( cell, trial );
 }
 
 /*******************************************************************************/
@@ -118,82 +219,15 @@ double anisotropyEnergy(int cell)
 double blobularEnergy(int cell)
 {
 
-
-	// iterate over each perimeter site, and for each
-	// iterate over logN perimeter sites (if N is the total number of perimeter sites)
-	// spaced out by logN
-	// and if the line between the site and the other site goes outside the cell
+	// iterate over the sampled perimeter sites (about one in logN, if N
+	// is the total number of perimeter sites), and for each pair of them
+	// if the line between the site and the other site goes outside the cell
 	// penalize
 
-  int N = cellPerimeterList[cell].size();
-  int logN = log( (double)N );
-  advanceAmount = logN;
-
-  int energy = 0;
-  int number = 0;
-
- // for(std::set< std::pair<int, int> >::const_iterator it1 = cellPerimeterList[cell].begin(); it1!=cellPerimeterList[cell].end(); ++it1){
-
-  int outerCount = 0;
-  std::set< std::pair<int, int> >::const_iterator it1(cellPerimeterList[cell].begin());
-  while( outerCount < N ){
-	  advance(it1, advanceAmount);
-	  outerCount += advanceAmount;
-
-	  int ai = it1->first;
-	  int aj = it1->second;
-
-	  int count = 0;
-	  std::set< std::pair<int, int> >::const_iterator it2(cellPerimeterList[cell].begin());
-	  while( count < N ){
-		  advance(it2,advanceAmount);
-
-		  int bi = it2->first;
-		  int bj = it2->second;
-
-		 int dx = bi-ai-N*(int)floor((float)(bi-ai)/(float)N+0.5);
-		  int sx = (dx>0)-(dx<0);
-		  int dy = bj-aj-N*(int)floor((float)(bj-aj)/(float)N+0.5);
-		  int sy = (dy>0)-(dy<0);
-
-		  double slope;
-		  if(dx!=0)
-			slope = (double)dy/(double)dx;
-		  else
-			slope = (double)N;
-
-		  int x = ai;
-		  int y = aj;
-		  double error = fabs(slope);
-
-		  do{
-			number++;
-			if(lattice[x][y][0]!=cell){
-			  energy++;
-			  goto done;
-			}
-			while(error>0.5){
-			  y=(y+sy+N)%N;
-			  number++;
-			  if(lattice[x][y][0]!=cell){
-				energy++;
-				goto done;
-			  }
-			  error=error-1.0;
-			}
-			x=(x+sx+N)%N;
-			error+=fabs(slope);
-		  }while(x!=(ai+dx+N)%N);
-
-		  done:;
-
-		  count += advanceAmount;
-    }
-
-
-  }
+	// This recounts every line; flip() uses the per-cell cache in
+	// potts_blobular_.h instead.
 
-  return L_blb * (double)energy * log((double)energy) / (double)(cellPerimeterList[cell].size());
+  return blobularPenalty( cell, countBlobular(cell) );
 
 }
 
@@ -1,7 +1,9 @@
 #include <utility>
-#include <set>
 #include <vector>
-#include <map>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
 
 /*******************************************************************************/
 
@@ -9,17 +11,77 @@
 /*** SPIN FLIP FUNCTIONS ***/
 
   int    flip();
+  int    attemptFlip();
   void   choose();
-  void	 addVolume( int i, int j, int cell);
-  void	 removeVolume( int i, int j, int cell);
+  bool   metropolis(double energy);
+  double boltzmannFactor(double energy);
   void   adjustPerimeters(int cell);
+  void   adjustPerimeters(int i, int j, int formerCell);
+  void   adjustPerimeterSite(int i, int j);
+  void   checkPerimeters(int cell);
   bool   maintainsContiguity();
-  std::map< std::pair<int, int> , int > calculateChunkSites(int, int);
+  template <int CHUNK> int  attemptFlip();
+  template <int CHUNK> struct flipChunk;
+  template <int CHUNK> double proposalEnergy(const flipChunk<CHUNK> &chunk);
+  template <int CHUNK> void commitFlip(const flipChunk<CHUNK> &chunk);
+  template <int CHUNK> bool maintainsContiguity();
+  template <> bool maintainsContiguity<0>();
+  template <int CHUNK> struct chunkDispatch;
+  bool   ringContiguous(const int *borders, int size, int cell);
+
+  // The sites of the chunk around (iSite,jSite) and the cells they were
+  // in.  Its size is known at compile time, so it lives on the stack.
+
+  template <int CHUNK> struct flipChunk
+  {
+    enum { SIDE = 2*CHUNK+1, SIZE = SIDE*SIDE };
+    int  i0, j0;               // first row and column, before wrapping
+    int  i[SIZE], j[SIZE], cell[SIZE];
+    void fill(int iCentre, int jCentre);
+    bool contains(int x, int y) const;
+  };
+
+  // These describe the flip under consideration.  They are per thread so
+  // that the parallel sweeps in potts_sweep_.h can each consider one.
+
+  thread_local int    iSite;
+  thread_local int    jSite;
+  thread_local int    oldCell;
+  thread_local int    newCell;
+  thread_local double deltaEnergy;
+
+  // exp(-beta*energy) of energy changes seen before, per thread
+  #define BOLTZMANN_SIZE 4096
+  struct boltzmannEntry { double energy, factor; };
+  thread_local boltzmannEntry boltzmannTable[BOLTZMANN_SIZE];
+  thread_local double boltzmannBeta = NAN;
+
+  // ringContiguous() of every pattern of the 8 sites around a single
+  // site, bit n set if border n is in the cell (see maintainsContiguity<0>)
+  struct ringTable
+  {
+    bool contiguous[256];
+    ringTable();
+  };
+  const ringTable singleSiteRing;
 
-  int    iSite;
-  int    jSite;
-  int    oldCell;
-  int    newCell;
+  // Calls the CHUNK = chunkSize version of a template, trying MAX_CHUNK
+  // first and counting down to 0, so there is one for every chunk
+  // applyConfig() lets through and none past it.
+
+  template <int CHUNK> struct chunkDispatch
+  {
+    static int  attemptFlip()
+      { return chunkSize==CHUNK ? ::attemptFlip<CHUNK>() : chunkDispatch<CHUNK-1>::attemptFlip(); }
+    static bool maintainsContiguity()
+      { return chunkSize==CHUNK ? ::maintainsContiguity<CHUNK>() : chunkDispatch<CHUNK-1>::maintainsContiguity(); }
+  };
+
+  template <> struct chunkDispatch<0>
+  {
+    static int  attemptFlip()          { return ::attemptFlip<0>(); }
+    static bool maintainsContiguity()  { return ::maintainsContiguity<0>(); }
+  };
 
 
 /*******************************************************************************/
@@ -32,134 +94,216 @@ int flip()
   // The site to be invaded is stored in iSite, jSite
   // newCell invades oldCell
 
+  PROFILE_START;
   choose();
-  std::map< std::pair<int, int> , int > chunk;
-  chunk = calculateChunkSites(iSite, jSite);
+  PROFILE_LAP( PHASE_PROPOSAL );
+
+  int accepted = attemptFlip();
+  if(accepted)
+    totalEnergy+=deltaEnergy;
+  return accepted;
+}
+
+/*******************************************************************************/
+/*** Accept or reject flipping the chosen spin ***/
+
+// Leaves the energy change in deltaEnergy; the caller adds it to
+// totalEnergy if the flip was accepted.  Most flips are not, so the energy
+// after the flip is worked out without touching the lattice or the cells,
+// and nothing has to be put back when it is rejected.
+
+int attemptFlip()
+{
+  return chunkDispatch<MAX_CHUNK>::attemptFlip();
+}
+
+template <int CHUNK> int attemptFlip()
+{
+
+  PROFILE_START;
+
+  flipChunk<CHUNK> chunk;
+  chunk.fill(iSite, jSite);
+
+  deltaEnergy = proposalEnergy( chunk );
+
+  // Accept or reject the flip
+
+  bool accept = metropolis( deltaEnergy );
+  PROFILE_LAP( PHASE_ENERGY );
+
+  if( accept ){
+    commitFlip( chunk );
+    PROFILE_COUNT( PROFILE_ACCEPTED, 1 );
+    PROFILE_LAP( PHASE_COMMIT );
+    return 1;
+  }
+  else{
+    rejectBlobular( oldCell );
+    rejectBlobular( newCell );
+    PROFILE_COUNT( PROFILE_REJECTED, 1 );
+    PROFILE_LAP( PHASE_COMMIT );
+    return 0;
+  }
+
+}
+
+/*******************************************************************************/
+/*** The energy change of flipping the chunk to newCell ***/
+
+// Touches nothing but the blobular caches, which hold the trial's line
+// counts until acceptBlobular() or rejectBlobular() (commitFlip() calls
+// the first, whoever drops the flip has to call the second).
 
+template <int CHUNK> double proposalEnergy(const flipChunk<CHUNK> &chunk)
+{
   // Subtract out parts of old energy associated with spin site
 
-  double deltaEnergy = 0.0;
+  double energy = 0.0;
 
-  for(std::map< std::pair<int, int> , int >::iterator it = chunk.begin(); it != chunk.end(); ++it){
-	  std::pair<int,int> point = it->first;
-	  deltaEnergy -= outplaneEnergy( point.first, point.second );
-	  deltaEnergy -= inplaneEnergy( point.first, point.second );
+  for(int n=0; n<chunk.SIZE; n++){
+	  int i = chunk.i[n];
+	  int j = chunk.j[n];
+	  energy -= outplaneEnergy( i, j );
+	  energy -= inplaneEnergy( i, j );
 
 	  // the four neighbor directions
-	  if( chunk.find( std::make_pair( point.first + 1, point.second ) ) != chunk.end() ){
-		  deltaEnergy -= inplaneEnergy( point.first + 1, point.second );
-		  deltaEnergy -= outplaneEnergy( point.first + 1, point.second );
+	  if( chunk.contains( i + 1, j ) ){
+		  energy -= inplaneEnergy( i + 1, j );
+		  energy -= outplaneEnergy( (i + 1)%N, j );
 	  }
 
-	  if( chunk.find( std::make_pair( (N + point.first - 1)%N, point.second ) ) != chunk.end() ){
-		  deltaEnergy -= inplaneEnergy( (N + point.first - 1)%N, point.second );
-		  deltaEnergy -= outplaneEnergy( point.first + 1, point.second );
+	  if( chunk.contains( (N + i - 1)%N, j ) ){
+		  energy -= inplaneEnergy( (N + i - 1)%N, j );
+		  energy -= outplaneEnergy( (i + 1)%N, j );
 	  }
 
-	  if( chunk.find( std::make_pair( point.first, point.second + 1 ) ) != chunk.end() ){
-		  deltaEnergy -= inplaneEnergy( point.first, point.second + 1 );
-		  deltaEnergy -= outplaneEnergy( point.first + 1, point.second );
+	  if( chunk.contains( i, j + 1 ) ){
+		  energy -= inplaneEnergy( i, j + 1 );
+		  energy -= outplaneEnergy( (i + 1)%N, j );
 	  }
 
-	  if( chunk.find( std::make_pair( point.first, ( N + point.second - 1)%N ) ) != chunk.end() ){
-		  deltaEnergy -= inplaneEnergy( point.first, ( N + point.second - 1)%N );
-		  deltaEnergy -= outplaneEnergy( point.first + 1, point.second );
+	  if( chunk.contains( i, ( N + j - 1)%N ) ){
+		  energy -= inplaneEnergy( i, ( N + j - 1)%N );
+		  energy -= outplaneEnergy( (i + 1)%N, j );
 	  }
   }
 
   if(oldCell!=0){
-    deltaEnergy -= volumeEnergy(oldCell);
- //   deltaEnergy -= anisotropyEnergy(oldCell);
-    deltaEnergy -= blobularEnergy(oldCell);
+    energy -= cellEnergies[oldCell].volume;
+    energy -= cellEnergies[oldCell].anisotropy;
+    energy -= cellEnergies[oldCell].blobular;
   }
 
   if(newCell!=0){
-    deltaEnergy -= volumeEnergy(newCell);
- //   deltaEnergy -= anisotropyEnergy(newCell);
-    deltaEnergy -= blobularEnergy(newCell);
+    energy -= cellEnergies[newCell].volume;
+    energy -= cellEnergies[newCell].anisotropy;
+    energy -= cellEnergies[newCell].blobular;
   }
 
-  // Flip it
-
-  for(std::map< std::pair<int, int> , int >::iterator it = chunk.begin(); it != chunk.end(); ++it){
-	  std::pair<int,int> point = it->first;
-	  lattice[ point.first ][ point.second ][0]=newCell;
-	  addVolume( point.first, point.second, newCell );
-	  removeVolume( point.first, point.second, oldCell );
-  }
+  // Add in energy associated with flipped site, as it would be: the
+  // trial view has the chunk in newCell, the lattice itself is only
+  // written once the flip is accepted
 
-  // Add in energy associated with flipped site
+  chunkView trial = { (N + chunk.i0)%N, (N + chunk.j0)%N, chunk.SIDE, newCell };
 
-  for(std::map< std::pair<int, int> , int >::iterator it = chunk.begin(); it != chunk.end(); ++it){
-	  std::pair<int,int> point = it->first;
-	  deltaEnergy += outplaneEnergy( point.first, point.second );
-	  deltaEnergy += inplaneEnergy( point.first, point.second );
+  for(int n=0; n<chunk.SIZE; n++){
+	  int i = chunk.i[n];
+	  int j = chunk.j[n];
+	  energy += outplaneEnergy( i, j, trial );
+	  energy += inplaneEnergy( i, j, trial );
 
 	  // the four neighbor directions
-	  if( chunk.find( std::make_pair( point.first + 1, point.second ) ) != chunk.end() )
+	  if( chunk.contains( i + 1, j ) )
 	  {
-		  deltaEnergy += inplaneEnergy( point.first + 1, point.second );
-		  deltaEnergy += outplaneEnergy( point.first + 1, point.second );
+		  energy += inplaneEnergy( i + 1, j, trial );
+		  energy += outplaneEnergy( (i + 1)%N, j, trial );
 	  }
 
-	  if( chunk.find( std::make_pair( (N + point.first - 1)%N, point.second ) ) != chunk.end() ){
-		  deltaEnergy += inplaneEnergy( (N + point.first - 1)%N, point.second );
-		  deltaEnergy += outplaneEnergy( point.first + 1, point.second );
+	  if( chunk.contains( (N + i - 1)%N, j ) ){
+		  energy += inplaneEnergy( (N + i - 1)%N, j, trial );
+		  energy += outplaneEnergy( (i + 1)%N, j, trial );
 	  }
 
-	  if( chunk.find( std::make_pair( point.first, point.second+1 ) ) != chunk.end() ){
-		  deltaEnergy += inplaneEnergy( point.first, point.second+1 );
-		  deltaEnergy += outplaneEnergy( point.first + 1, point.second );
+	  if( chunk.contains( i, j+1 ) ){
+		  energy += inplaneEnergy( i, j+1, trial );
+		  energy += outplaneEnergy( (i + 1)%N, j, trial );
 	  }
 
-	  if( chunk.find( std::make_pair( point.first, ( N + point.second - 1)%N ) ) != chunk.end() ){
-		  deltaEnergy += inplaneEnergy( point.first, ( N + point.second - 1)%N );
-		  deltaEnergy += outplaneEnergy( point.first + 1, point.second );
+	  if( chunk.contains( i, ( N + j - 1)%N ) ){
+		  energy += inplaneEnergy( i, ( N + j - 1)%N, trial );
+		  energy += outplaneEnergy( (i + 1)%N, j, trial );
 	  }
   }
 
+  // the chunk's sites go from whatever cell they were in to newCell
+
+  int lost = 0, gained = 0;
+  for(int n=0; n<chunk.SIZE; n++){
+	  lost += chunk.cell[n]==oldCell;
+	  gained += chunk.cell[n]!=newCell;
+  }
+
   if(oldCell!=0){
-    deltaEnergy += volumeEnergy(oldCell);
-   // deltaEnergy += anisotropyEnergy(oldCell);
-    deltaEnergy += blobularEnergy(oldCell);
+    energy += volumePenalty( cellVolumeList[oldCell].size()-lost );
+    energy += trialAnisotropyEnergy(oldCell, trial);
+    energy += trialBlobularEnergy(oldCell, iSite, jSite, trial);
   }
 
   if(newCell!=0){
-    deltaEnergy += volumeEnergy(newCell);
-  //  deltaEnergy += anisotropyEnergy(newCell);
-    deltaEnergy += blobularEnergy(newCell);
+    energy += volumePenalty( cellVolumeList[newCell].size()+gained );
+    energy += trialAnisotropyEnergy(newCell, trial);
+    energy += trialBlobularEnergy(newCell, iSite, jSite, trial);
   }
 
-  // Accept or reject the flip
+  return energy;
+}
 
-  if( deltaEnergy < 0 ){
-    totalEnergy+=deltaEnergy;
-    adjustPerimeters( newCell );
-    adjustPerimeters( oldCell );
-    return 1;
-  }
-  else if( exp(-1.0*beta*deltaEnergy) > (double)rand()/(double)RAND_MAX ){
-    totalEnergy+=deltaEnergy;
-    adjustPerimeters( newCell );
-    adjustPerimeters( oldCell );
-    return 1;
+/*******************************************************************************/
+/*** Carries out the flip proposalEnergy() worked out ***/
 
-  }
-  else{
-	  for(std::map< std::pair<int, int> , int >::iterator it = chunk.begin(); it != chunk.end(); ++it){
-		  std::pair<int,int> point = it->first;
-		  int originalCellType = it->second;
-		  lattice[ point.first ][ point.second ][0]=originalCellType;
-		  if( originalCellType == oldCell ){
-			  removeVolume( point.first, point.second, newCell );
-			  addVolume( point.first, point.second, oldCell );
-		  }
-		  // if originalCellType was already newCell, then nothing has changed
-		  // that is, the invasion did not cause this i,j site to change type
-	  }
-	  return 0;
+template <int CHUNK> void commitFlip(const flipChunk<CHUNK> &chunk)
+{
+  // Flip it
+
+  for(int n=0; n<chunk.SIZE; n++){
+    lattice[ chunk.i[n] ][ chunk.j[n] ][0]=newCell;
+    moveContacts( chunk.i[n], chunk.j[n], chunk.cell[n], newCell );
+    removeVolume( chunk.i[n], chunk.j[n], chunk.cell[n] );
+    addVolume( chunk.i[n], chunk.j[n], newCell );
   }
 
+  for(int n=0; n<chunk.SIZE; n++)
+    adjustPerimeters( chunk.i[n], chunk.j[n], chunk.cell[n] );
+  #if CHECK_PERIMETERS
+  checkPerimeters( newCell );
+  checkPerimeters( oldCell );
+  if(numThreads==1)
+    checkContacts();   // the whole lattice; with sweeps, once a loop in simulate()
+  #endif
+
+  // a chunk can also reach into a third cell, whose lines need re-testing too
+  acceptBlobular( oldCell, iSite, jSite );
+  acceptBlobular( newCell, iSite, jSite );
+  for(int n=0; n<chunk.SIZE; n++)
+    if( chunk.cell[n]!=oldCell && chunk.cell[n]!=newCell )
+      acceptBlobular( chunk.cell[n], iSite, jSite );
+  resampleBlobular( oldCell, iSite, jSite );
+  resampleBlobular( newCell, iSite, jSite );
+  for(int n=0; n<chunk.SIZE; n++)
+    if( chunk.cell[n]!=oldCell && chunk.cell[n]!=newCell )
+      resampleBlobular( chunk.cell[n], iSite, jSite );
+  updateCellEnergy( oldCell );
+  updateCellEnergy( newCell );
+  for(int n=0; n<chunk.SIZE; n++)
+    if( chunk.cell[n]!=oldCell && chunk.cell[n]!=newCell )
+      updateCellEnergy( chunk.cell[n] );
+  #if CHECK_BLOBULAR
+  checkBlobular( newCell );
+  checkBlobular( oldCell );
+  checkCellEnergy( newCell );
+  checkCellEnergy( oldCell );
+  #endif
 }
 
 /*******************************************************************************/
@@ -168,40 +312,60 @@ int flip()
 void choose()
 {
 
+  // the four neighbor directions as (which, thing) pairs
+  static const int whichDir[4] = { 0, 0, 1, 1 };
+  static const int thingDir[4] = { 1, -1, 1, -1 };
+
+  bool contiguous;
+
   do{
 
     int which,thing;
 
     // Choose a cell
-    oldCell = (rand()%numCells)+1;
+    oldCell = randomInt(numCells)+1;
 
     // Choose a perimeter site within that cell to either extend or surrender
-    std::set< std::pair<int, int> >::const_iterator it(cellPerimeterList[oldCell].begin());
-    int p = rand()%cellPerimeterList[oldCell].size();
-    advance(it,p);
-    iSite = it->first;
-    jSite = it->second;
+    // (the perimeter is a dense array, so this is a single lookup)
+    int p = randomInt( cellPerimeterList[oldCell].size() );
+    iSite = cellPerimeterList[oldCell][p].first;
+    jSite = cellPerimeterList[oldCell][p].second;
 
 
     // Choose a neighboring site either up, down, left, or right
     // newCell invades oldCell
     // bit of a misnomer; either one of these could be air
 
-    do{
-      which = rand()%2;
-      thing = 2*(rand()%2)-1;
-      if(which==0)
-         newCell = lattice[(N+iSite+thing)%N][jSite][0];
+    // Being a perimeter site, at least one neighbor belongs to another
+    // cell, so pick uniformly among those directly rather than redrawing
+    // directions until one differs.
+
+    int dirs[4];
+    int numDirs = 0;
+    for(int d=0; d<4; d++){
+      int neighbor;
+      if(whichDir[d]==0)
+        neighbor = lattice[(N+iSite+thingDir[d])%N][jSite][0];
       else
-        newCell = lattice[iSite][(N+jSite+thing)%N][0];
-    }while( oldCell == newCell );
+        neighbor = lattice[iSite][(N+jSite+thingDir[d])%N][0];
+      if(neighbor!=oldCell)
+        dirs[numDirs++] = d;
+    }
+
+    int d = dirs[ randomInt(numDirs) ];
+    which = whichDir[d];
+    thing = thingDir[d];
+    if(which==0)
+      newCell = lattice[(N+iSite+thing)%N][jSite][0];
+    else
+      newCell = lattice[iSite][(N+jSite+thing)%N][0];
 
 
 	  // Choose to invade or surrender
 	  // (that is, if you randomly generate an even number, then
 	  // switch from surrendering to invading)
 
-    if(rand()%2==0){
+    if(randomInt(2)==0){
       int tmp = oldCell;
       oldCell = newCell;
       newCell = tmp;
@@ -211,19 +375,78 @@ void choose()
         jSite = (N+jSite+thing)%N;
     }
 
-  }while(!maintainsContiguity());
+    contiguous = maintainsContiguity();
+    PROFILE_COUNT( PROFILE_PROPOSALS, 1 );
+    PROFILE_COUNT( PROFILE_CONTIGUITY, !contiguous );
+
+  }while(!contiguous);
 
   return;
 }
 
+/*******************************************************************************/
+/*** The Metropolis test: accept a change in energy or not ***/
+
+/*
+    With ACCEPTANCE
+      0  exp() is called for every uphill change
+      1  exp() is only called for energy changes not seen before.  With
+         just interaction and volume terms the change takes a handful of
+         values, so nearly every test is a lookup.
+      2  the uniform is turned around instead: u < exp(-beta*dE) is the
+         same as beta*dE < -log(u), and the -log(u) are made in batches
+         ahead of time (see thresholdRandom), so the test is a compare.
+    0 and 1 make the same decisions from the same random numbers.
+*/
+
+bool metropolis(double energy)
+{
+  if(energy<0)
+    return true;
+
+  switch(acceptance){
+    case 1:
+      return boltzmannFactor(energy) > uniformRandom();
+    case 2:
+      return beta*energy < thresholdRandom();
+    default:
+      return exp(-1.0*beta*energy) > uniformRandom();
+  }
+}
+
+double boltzmannFactor(double energy)
+{
+  if(boltzmannBeta!=beta){
+    for(int n=0;n<BOLTZMANN_SIZE;n++)
+      boltzmannTable[n].energy = -1.0;
+    boltzmannBeta = beta;
+  }
+
+  uint64_t bits;
+  memcpy( &bits, &energy, sizeof(bits) );
+  boltzmannEntry &e = boltzmannTable[ (bits*0x9e3779b97f4a7c15ull)>>52 ];
+
+  if(e.energy!=energy){
+    e.energy = energy;
+    e.factor = exp(-1.0*beta*energy);
+  }
+  return e.factor;
+}
+
 /*******************************************************************************/
 /*** Checks if the invasion would cause a cell to break into multiple pieces ***/
 /*** Returns FALSE if so (returns TRUE if the flip would maintainContiguity) ***/
 
 bool maintainsContiguity()
+{
+  return chunkDispatch<MAX_CHUNK>::maintainsContiguity();
+}
+
+template <int CHUNK> bool maintainsContiguity()
 {
 
-  std::vector<int> borders;
+  int borders[ 8*(CHUNK+1) ];
+  int size = 0;
 
   // If the o's in the diagram below are sites in the chunk to the flipped
   // then borders are the x sites
@@ -247,8 +470,8 @@ bool maintainsContiguity()
   x o o o o o x
   x x x x x x x
   */
-  for( int i = iSite - chunkSize - 1; i <= iSite + chunkSize; i++ )
-	  borders.push_back( lattice[ (N + i)%N ][ jSite - chunkSize - 1 ][0] );
+  for( int i = iSite - CHUNK - 1; i <= iSite + CHUNK; i++ )
+	  borders[size++] = lattice[ (N + i)%N ][ (N + jSite - CHUNK - 1)%N ][0];
 
   /* add the right-side column of x's
   x x x x x x X
@@ -259,32 +482,27 @@ bool maintainsContiguity()
   x o o o o o X
   x x x x x x x
   */
-  for( int j = jSite - chunkSize - 1; j <= jSite + chunkSize; j++ )
-	  borders.push_back( lattice[ iSite + chunkSize + 1  ][ (N + j)%N ][0] );
+  for( int j = jSite - CHUNK - 1; j <= jSite + CHUNK; j++ )
+	  borders[size++] = lattice[ (iSite + CHUNK + 1)%N ][ (N + j)%N ][0];
 
   // the bottom row
-  for( int i = iSite + chunkSize + 1; i >= iSite - chunkSize; i-- )
-	  borders.push_back( lattice[ (N + i)%N ][ jSite + chunkSize + 1 ][0] );
+  for( int i = iSite + CHUNK + 1; i >= iSite - CHUNK; i-- )
+	  borders[size++] = lattice[ (N + i)%N ][ (jSite + CHUNK + 1)%N ][0];
 
   // the left-side column
-  for( int j = jSite + chunkSize + 1; j >= jSite - chunkSize; j-- )
-	  borders.push_back( lattice[ iSite - chunkSize - 1  ][ (N + j)%N ][0] );
+  for( int j = jSite + CHUNK + 1; j >= jSite - CHUNK; j-- )
+	  borders[size++] = lattice[ (N + iSite - CHUNK - 1)%N ][ (N + j)%N ][0];
 
   // NOTE: THE BORDER SITES MUST BE ADDED IN CONTINUOUS ORDER FOR THIS
   // ALGORITHM TO WORK.
 
+  return ringContiguous( borders, size, oldCell );
+}
 
-  /*
-  int borders[8] = { lattice[(N+iSite-1)%N][(N+jSite-1)%N][0],
-                     lattice[(N+iSite-1)%N][jSite][0],
-                     lattice[(N+iSite-1)%N][(jSite+1)%N][0],
-                     lattice[iSite][(jSite+1)%N][0],
-                     lattice[(iSite+1)%N][(jSite+1)%N][0],
-                     lattice[(iSite+1)%N][jSite][0],
-                     lattice[(iSite+1)%N][(N+jSite-1)%N][0],
-                     lattice[iSite][(N+jSite-1)%N][0] };
-  */
+// Is the cell one unbroken stretch of the ring of border sites?
 
+bool ringContiguous(const int *borders, int size, int cell)
+{
   /*
 	Count how many neighboring spins are in the same cell.
 	If there are none, then this is the last spin of that cell.
@@ -292,8 +510,8 @@ bool maintainsContiguity()
   */
 
   int totalCellCount = 0;
-  for(int n=0; n<borders.size(); n++)
-    if(borders[n] == oldCell)
+  for(int n=0; n<size; n++)
+    if(borders[n] == cell)
       totalCellCount++;   
  
   if(totalCellCount==0)
@@ -309,14 +527,14 @@ bool maintainsContiguity()
    */
 
   int index = 0;
-  while(index < borders.size() && borders[index] == oldCell)
+  while(index < size && borders[index] == cell)
     index++;
      
   /*
 	Then move along until the site just before the next cell spin.
   */
 
-  while(index < borders.size()-1 && borders[index+1] != oldCell)
+  while(index < size-1 && borders[index+1] != cell)
     index++;
 
   /*
@@ -329,8 +547,8 @@ bool maintainsContiguity()
   int inCellCount = 0;
   while (inCellCount < totalCellCount)
   {
-    index=(index+1)%(borders.size());
-    if(borders[index] != oldCell)
+    index=(index+1)%size;
+    if(borders[index] != cell)
       return false;
     inCellCount++;
   }
@@ -339,56 +557,87 @@ bool maintainsContiguity()
 }
 
 /*******************************************************************************/
-/*** Find the square chunk of sites around the chosen flip site corresponding to chunkSize ***/
+/*** The same for a single site, by table ***/
 
-std::map< std::pair<int, int>, int > calculateChunkSites( int i, int j ){
-	std::map< std::pair<int, int>, int > chunk;
-	for( int x=i-chunkSize; x<=i+chunkSize; x++ ){
-		for( int y=j-chunkSize; y<=j+chunkSize; y++){
-			std::pair<int, int> p;
-			p.first = (x+N)%N;
-			p.second = (y+N)%N;
+// The eight sites around (iSite,jSite), in the order the general version
+// goes round them, each a bit of the pattern; which patterns keep the
+// cell in one piece was worked out once, by ringContiguous() itself.
 
-			chunk.insert( std::pair< std::pair<int,int> , int>(p, lattice[ p.first ][ p.second ][0]) );
-		}
-	}
-	return chunk;
+template <> bool maintainsContiguity<0>()
+{
+  int im = (N+iSite-1)%N, ip = (iSite+1)%N;
+  int jm = (N+jSite-1)%N, jp = (jSite+1)%N;
+
+  int pattern = ( lattice[im][jm][0]==oldCell )
+              | ( lattice[iSite][jm][0]==oldCell )<<1
+              | ( lattice[ip][jm][0]==oldCell )<<2
+              | ( lattice[ip][jSite][0]==oldCell )<<3
+              | ( lattice[ip][jp][0]==oldCell )<<4
+              | ( lattice[iSite][jp][0]==oldCell )<<5
+              | ( lattice[im][jp][0]==oldCell )<<6
+              | ( lattice[im][jSite][0]==oldCell )<<7;
+
+  return singleSiteRing.contiguous[pattern];
 }
 
-/*******************************************************************************/
-/*** Adjusts volume after a spin flip ***/
-
-void removeVolume(int i, int j, int cell)
+ringTable::ringTable()
 {
-  if(cell!=0){
-	  std::set< std::pair<int,int> >::iterator it = cellVolumeList[cell].find( std::make_pair(i,j) );
-	  if( it != cellVolumeList[cell].end() )
-		cellVolumeList[cell].erase( it );
+  for(int pattern=0;pattern<256;pattern++){
+    int borders[8];
+    for(int n=0;n<8;n++)
+      borders[n] = (pattern>>n)&1;
+    contiguous[pattern] = ringContiguous( borders, 8, 1 );
   }
-  return;
 }
 
-void addVolume(int i, int j, int cell){
-  if(cell!=0)
-	  cellVolumeList[cell].insert( std::make_pair(i,j) );
-  return;
+/*******************************************************************************/
+/*** Find the square chunk of sites around the chosen flip site corresponding to chunkSize ***/
+
+// The sites go in order of their wrapped (i,j), so the energies of a
+// chunk are always added up in the same order wherever it sits.
+
+template <int CHUNK> void flipChunk<CHUNK>::fill( int iCentre, int jCentre ){
+	i0 = iCentre-CHUNK;
+	j0 = jCentre-CHUNK;
+
+	// where the wrapped rows and columns start over from 0, if they do
+	int firstRow = i0<0 ? -i0 : ( i0+SIDE>N ? N-i0 : 0 );
+	int firstColumn = j0<0 ? -j0 : ( j0+SIDE>N ? N-j0 : 0 );
+
+	int n = 0;
+	for( int a=0; a<SIDE; a++ ){
+		int x = (N + i0 + (firstRow+a)%SIDE)%N;
+		for( int b=0; b<SIDE; b++ ){
+			int y = (N + j0 + (firstColumn+b)%SIDE)%N;
+			i[n] = x;
+			j[n] = y;
+			cell[n] = lattice[x][y][0];
+			n++;
+		}
+	}
 }
 
+// Whether (x,y) is a site of the chunk.  x and y are not wrapped, so an
+// x or y of N is never in it; attemptFlip() has always counted it so.
+
+template <int CHUNK> bool flipChunk<CHUNK>::contains( int x, int y ) const {
+	return x<N && y<N && (N + x - i0)%N < SIDE && (N + y - j0)%N < SIDE;
+}
 
 /*******************************************************************************/
-/*** Adjusts perimeters after a spin flip ***/
+/*** Rebuilds the perimeter of a cell from scratch ***/
 
 void adjustPerimeters( int cell ){
 
-	// shorter way to do this: see if any of the chunk sites need to be added to the perimeter
-	// run through all old perimeter sites and if they no longer need to be part of the perimeter, erase them from cellPerimeterList
-	// ** note ^ doesn't quite work for the cell being invaded
+	// This rescans every site of the cell, so flip() uses the local version
+	// below and this is only kept around for checkPerimeters()
 
 	if( cell != 0 ){
-		cellPerimeterList[cell].clear();
-		  for( std::set< std::pair<int, int> >::const_iterator it = cellVolumeList[cell].begin(); it!= cellVolumeList[cell].end(); ++it){
-			int i = it->first;
-			int j = it->second;
+		PROFILE_COUNT( PROFILE_PERIMETERS, 1 );
+		clearPerimeter( cell );
+		  for( int n = 0; n < (int)cellVolumeList[cell].size(); n++ ){
+			int i = cellVolumeList[cell][n].first;
+			int j = cellVolumeList[cell][n].second;
 			if(lattice[i][j][0] != cell )
 					printf("\nproblem: (%d, %d)", i, j);
 		    if( lattice[i][j][0]!=lattice[(i+1)%N][j][0] ||
@@ -396,120 +645,83 @@ void adjustPerimeters( int cell ){
 		        lattice[i][j][0]!=lattice[(N+i-1)%N][j][0] ||
 		        lattice[i][j][0]!=lattice[i][(N+j-1)%N][0] )
 		    {
-			  cellPerimeterList[ cell ].insert( std::make_pair(i, j) );
+			  addPerimeter( i, j, cell );
 		    }
 		  }
 	}
 }
 
-/*
-void adjustPerimeters(int i, int j)
+/*******************************************************************************/
+/*** Adjusts perimeters after a spin flip ***/
+
+void adjustPerimeters(int i, int j, int formerCell)
 {
-yo
-  //  Site used to be a perimeter spin in oldCell.
-  //  We had better remove it.
-
-   if(oldCell!=0){
-	   std::map< std::pair<int,int> >::iterator it = cellPerimeterList[oldCell].find( std::make_pair(i,j) );
-	   if( it != cellPerimeterList[oldCell].end() )
-	     cellPerimeterList[oldCell].erase( it );
-   }
-
-
-  //  Site is now a perimeter cell in newCell.
-  //  We had better add it.
-
-  if(newCell!=0)
-    cellPerimeterList[newCell].insert( std::make_pair(i,j) );
-
-
-  //  Now we need to go through each of Site's four neighbors,
-  //  rechecking if they are perimeter cells.
-
-
-  int iTest,jTest,iTempA,jTempA,iTempB,jTempB,iTempC,jTempC;
-
-  for(int neighbor=0;neighbor<4;neighbor++){
-
-    // tedious setup
-    switch(neighbor){
-
-      case 0:
-      iTest = (i+1)%N;
-      jTest = j;
-      iTempA = (iTest+1)%N;
-      jTempA = jTest;
-      iTempB = iTest;
-      jTempB = (jTest+1)%N;
-      iTempC = iTest;
-      jTempC = (N+jTest-1)%N;
-      break;
-
-      case 1:
-      iTest = (N+i-1)%N;
-      jTest = j;
-      iTempA = (N+iTest-1)%N;
-      jTempA = jTest;
-      iTempB = iTest;
-      jTempB = (jTest+1)%N;
-      iTempC = iTest;
-      jTempC = (N+jTest-1)%N;
-      break;
-
-      case 2:
-      iTest = i;
-      jTest = (j+1)%N;
-      iTempA = (iTest+1)%N;
-      jTempA = jTest;
-      iTempB = (N+iTest-1)%N;
-      jTempB = jTest;
-      iTempC = iTest;
-      jTempC = (jTest+1)%N;
-      break;
-
-      case 3:
-      iTest  = i;
-      jTest  = (N+j-1)%N;
-      iTempA = (iTest+1)%N;
-      jTempA = jTest;
-      iTempB = (N+iTest-1)%N;
-      jTempB = jTest;
-      iTempC = iTest;
-      jTempC = (N+jTest-1)%N;
-      break;
 
-    }
+  //  Site (i,j) was just flipped from formerCell to newCell, so the only
+  //  sites whose perimeter status can have changed are the site itself
+  //  and its four neighbors.
 
-    // only do this for non-air
-    if(lattice[iTest][jTest][0]!=0){
-
-      // is surely a perimeter now, but maybe used to be as well
-      if(lattice[iTest][jTest][0]==oldCell){
-        // if it wasn't before, then add it
-        if( lattice[iTempA][jTempA][0]==oldCell &&
-            lattice[iTempB][jTempB][0]==oldCell &&
-            lattice[iTempC][jTempC][0]==oldCell )
-          cellPerimeterList[oldCell].insert( std::make_pair(iTest, jTest));
-      }
-
-      // used to be a perimeter, might not be any more
-      else if(lattice[iTest][jTest][0]==newCell){
-        // if it isn't any more, then remove it
-        if( lattice[iTempA][jTempA][0]==newCell &&
-            lattice[iTempB][jTempB][0]==newCell &&
-            lattice[iTempC][jTempC][0]==newCell ){
-     	   std::map< std::pair<int,int> >::iterator it = cellPerimeterList[newCell].find( std::make_pair(iTest,jTest) );
-     	   if( it != cellPerimeterList[newCell].end() )
-     	     cellPerimeterList[newCell].erase( it );
-        }
-      }
+  //  Site used to be in formerCell (usually oldCell, but a chunk can
+  //  reach into a third cell).  We had better remove it.
 
-    }
+  if(formerCell!=newCell)
+    removePerimeter( i, j, formerCell );
 
-  }
+  //  Now recheck Site and each of its four neighbors.
+
+  adjustPerimeterSite( i, j );
+  adjustPerimeterSite( (i+1)%N, j );
+  adjustPerimeterSite( (N+i-1)%N, j );
+  adjustPerimeterSite( i, (j+1)%N );
+  adjustPerimeterSite( i, (N+j-1)%N );
+
+  return;
+}
+
+/*******************************************************************************/
+/*** Adds or removes a single site from its cell's perimeter ***/
+
+void adjustPerimeterSite(int i, int j)
+{
+  int cell = lattice[i][j][0];
+
+  // only do this for non-air
+  if(cell==0)
+    return;
+
+  if( cell!=lattice[(i+1)%N][j][0] ||
+      cell!=lattice[i][(j+1)%N][0] ||
+      cell!=lattice[(N+i-1)%N][j][0] ||
+      cell!=lattice[i][(N+j-1)%N][0] )
+    addPerimeter( i, j, cell );
+  else
+    removePerimeter( i, j, cell );
 
   return;
+}
+
+/*******************************************************************************/
+/*** Debugging: compares a cell's perimeter against a full rebuild ***/
+
+void checkPerimeters(int cell)
+{
+  if(cell==0)
+    return;
+
+  // the lists are unordered, so sort copies before comparing
+
+  std::vector< std::pair<int, int> > incremental = cellPerimeterList[cell];
+  adjustPerimeters( cell );
+  std::vector< std::pair<int, int> > rebuilt = cellPerimeterList[cell];
+
+  std::sort( incremental.begin(), incremental.end() );
+  std::sort( rebuilt.begin(), rebuilt.end() );
 
+  if( incremental != rebuilt )
+    printf("\nproblem: perimeter of cell %d has %d sites, should have %d",
+           cell, (int)incremental.size(), (int)rebuilt.size());
+
+  return;
 }
-*/
+
 /*******************************************************************************/
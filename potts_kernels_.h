@@ -0,0 +1,164 @@
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/*******************************************************************************/
+/*** WHOLE LATTICE FUNCTIONS ***/
+
+  struct splitLattice
+  {
+    int stride;                           // N+2
+    int words;                            // 64 bit words to a row of collagen
+    std::vector<int>           cell;      // the cell layer, with a halo a site wide
+    std::vector<uint64_t>      collagen;  // the collagen layer, a bit to a site
+    std::vector<unsigned char> boundary;  // N x N, 1 on every perimeter site
+  };
+
+  splitLattice split;
+
+  void    packLattice();
+  void    packCollagen();
+  void    boundaryMask();
+  double  latticeInteractionEnergy();
+
+/*
+    Going over the whole lattice with lattice[i][j][0] and a %N on every
+    neighbour is branchy and strided, with the collagen layer in between
+    every cell.  packLattice() copies the lattice into split: the cell
+    layer on its own, padded with a copy of the far side all round, so
+    the neighbours of a row are just the rows above and below and the
+    sites either side; packCollagen() the collagen layer as bits, which
+    are only looked at where they are set.  The kernels then go
+    row by row without a %N or a branch, which the compiler can turn
+    into SIMD on whatever it targets (#pragma omp simd, so nothing
+    processor specific); what's left is mostly memory traffic.
+
+    The per flip code still works on the lattice itself: a flip only
+    looks at a handful of sites, where keeping a second copy up to date
+    would cost more than it saves.  These are for Hamiltonian() and the
+    perimeter rebuilds, which look at every site.
+*/
+
+/*******************************************************************************/
+/*** Copies the cell layer into split ***/
+
+void packLattice()
+{
+  int n = N;   // a local, or every store here might have changed N
+  int stride = n+2;
+
+  split.stride = stride;
+  split.cell.resize( stride*stride );
+  split.boundary.resize( n*n );
+
+  for(int i=0;i<n;i++){
+    int *row = &split.cell[(i+1)*stride];
+    const int (*sites)[2] = lattice[i];
+    #pragma omp simd
+    for(int j=0;j<n;j++)
+      row[j+1] = sites[j][0];
+    row[0] = row[n];
+    row[n+1] = row[1];
+  }
+  memcpy( &split.cell[0], &split.cell[n*stride], stride*sizeof(int) );
+  memcpy( &split.cell[(n+1)*stride], &split.cell[stride], stride*sizeof(int) );
+}
+
+// and the collagen layer, which is slower to pack and not often needed
+
+void packCollagen()
+{
+  int n = N;
+  int words = (n+63)/64;
+
+  split.words = words;
+  split.collagen.assign( n*words, 0 );
+
+  for(int i=0;i<n;i++){
+    const int (*sites)[2] = lattice[i];
+    int any = 0;
+    #pragma omp simd reduction(|:any)
+    for(int j=0;j<n;j++)
+      any |= sites[j][1];
+    if(any==0)
+      continue;
+
+    uint64_t *bits = &split.collagen[i*words];
+    for(int w=0;w<words;w++){
+      const int (*word)[2] = sites+64*w;
+      int length = n-64*w<64 ? n-64*w : 64;
+      uint64_t b = 0;
+      for(int k=0;k<length;k++)
+        b |= (uint64_t)(word[k][1]!=0) << k;
+      bits[w] = b;
+    }
+  }
+}
+
+/*******************************************************************************/
+/*** Marks every site that is on the perimeter of its cell ***/
+
+// needs packLattice() first
+
+void boundaryMask()
+{
+  int n = N;
+  for(int i=0;i<n;i++){
+    const int *row = &split.cell[(i+1)*split.stride+1];
+    const int *above = row-split.stride;
+    const int *below = row+split.stride;
+    unsigned char *mask = &split.boundary[i*n];
+
+    #pragma omp simd
+    for(int j=0;j<n;j++){
+      int s = row[j];
+      mask[j] = (s>0) & ( (s!=above[j]) | (s!=below[j]) | (s!=row[j-1]) | (s!=row[j+1]) );
+    }
+  }
+}
+
+/*******************************************************************************/
+/*** Returns the interaction energy of every cell at once ***/
+
+// the sum of interactionEnergy() over the cells, from the lattice rather
+// than the lists: the sites of each kind are counted, and only then
+// multiplied by their energy
+
+double latticeInteractionEnergy()
+{
+  long touchCell = 0, touchAir = 0, onCollagen = 0;
+  int n = N;
+
+  packLattice();
+  packCollagen();
+
+  for(int i=0;i<n;i++){
+    const int *row = &split.cell[(i+1)*split.stride+1];
+    const int *above = row-split.stride;
+    const int *below = row+split.stride;
+    int rowCell = 0, rowAir = 0;
+
+    #pragma omp simd reduction(+:rowCell,rowAir)
+    for(int j=0;j<n;j++){
+      int s = row[j];
+      int a = above[j], b = below[j], l = row[j-1], r = row[j+1];
+      int occupied = s>0;
+      int differs = (s!=a) | (s!=b) | (s!=l) | (s!=r);
+      int cell = ((s!=a)&(a>0)) | ((s!=b)&(b>0)) | ((s!=l)&(l>0)) | ((s!=r)&(r>0));
+      rowCell += occupied & cell;
+      rowAir += occupied & differs & (cell^1);
+    }
+    touchCell += rowCell;
+    touchAir += rowAir;
+
+    // collagen is sparse, so only its own sites are looked at
+    const uint64_t *bits = &split.collagen[i*split.words];
+    for(int w=0;w<split.words;w++)
+      for(uint64_t word=bits[w]; word!=0; word&=word-1)
+        onCollagen += row[ 64*w+__builtin_ctzll(word) ]>0;
+  }
+
+  return touchCell*J_cel + touchAir*J_air + onCollagen*J_col;
+}
+
+/*******************************************************************************/
@@ -0,0 +1,281 @@
+#include <math.h>
+#include <limits.h>
+#include <vector>
+
+/*******************************************************************************/
+/*** N-FOLD WAY FUNCTIONS ***/
+
+  void    initNfold();
+  int     nfoldFlips(int attempts);
+  void    nfoldEvent();
+  void    rateSite(int i, int j);
+  void    setRate(int move, double rate, bool valid);
+  void    buildRateTree();
+  double  rateSum();
+  int     findMove(double x);
+  int     moveNeighbour(int i, int j, int d);
+
+  std::vector<double> moveRate;    // 4 to a site, for taking each neighbour's cell
+  std::vector<char>   moveValid;   // ... if it can be taken at all
+  std::vector<double> rateTree;    // Fenwick tree of moveRate, from 1
+  std::vector<int>    rateStamp;   // the event a site was last rated at
+  long   validMoves = 0;
+  long   nfoldWait = -1;           // attempts until the next event, counting it, or -1 to draw
+  int    nfoldEvents = 0;          // since the tree was last built from scratch
+
+/*
+    With ENGINE 1 the run goes by the n-fold way (Bortz, Kalos and
+    Lebowitz) instead of proposing flips and turning most of them down.
+    Every move there is, site (i,j) taking the cell of one of its four
+    neighbours, has a rate, min(1, exp(-beta*dE)), or 0 if it isn't a
+    move (same cell, or it would break a cell up); the rates sit in a
+    binary indexed tree, so one with probability rate/total is found in
+    O(log) and every event is a flip that happens.
+
+    That is the chain "pick one of the M valid moves and accept it with
+    the Metropolis probability" without the rejections: the number of
+    its attempts up to and including the next acceptance is geometric
+    with p = total/M, so that is drawn and the clock, in attempts, moves
+    on by that much.  A loop is still FLIPS attempts, so aaa_energy_.txt
+    and everything else come out the same as ever (the acceptance column
+    is events over attempts).  The proposals aren't drawn quite like
+    choose() draws them (by cell first), so the clock doesn't tick at
+    exactly the same rate as the Metropolis engine's.
+
+    After an event, the rates that can have changed are those of the
+    sites around it (their neighbours and their contiguity ring) and of
+    every move into or out of the two cells, whose volume, anisotropy
+    and blobular energies have all changed.  Those are rated again, with
+    the same proposalEnergy() flip() uses.  That makes an event cost
+    about as much as 150 flips, so it only pays off once fewer than one
+    proposal in 150 or so would be accepted.  With the energies as they
+    are some moves along the perimeter always cost nothing, and even at
+    BETA 40 about one in 30 is accepted; it is there for frozen runs.
+
+    Only CHUNKSIZE 0 and THREADS 1; ACCEPTANCE doesn't come into it.
+*/
+
+/*******************************************************************************/
+/*** Rates every move on the lattice ***/
+
+void initNfold()
+{
+  moveRate.assign( 4*N*N, 0.0 );
+  moveValid.assign( 4*N*N, 0 );
+  rateStamp.assign( N*N, -1 );
+  validMoves = 0;
+
+  // a resumed run carries on with the wait its checkpoint had
+  if(resumeDir[0]=='\0')
+    nfoldWait = -1;
+
+  for(int i=0;i<N;i++)
+    for(int j=0;j<N;j++)
+      rateSite(i,j);
+  buildRateTree();
+}
+
+/*******************************************************************************/
+/*** Runs the given number of attempts, returns the events ***/
+
+int nfoldFlips(int attempts)
+{
+  int events = 0;
+
+  while(true){
+    if(nfoldWait<0){
+      double total = rateSum();
+      if(total<=0.0 || validMoves==0)
+        nfoldWait = LONG_MAX;   // frozen
+      else if(total>=validMoves)
+        nfoldWait = 1;
+      else
+        nfoldWait = 1 + (long)floor( thresholdRandom() / -log1p(-total/validMoves) );
+    }
+    if(nfoldWait>attempts){
+      if(nfoldWait!=LONG_MAX)
+        nfoldWait -= attempts;
+      return events;
+    }
+    attempts -= nfoldWait;
+    nfoldWait = -1;
+
+    nfoldEvent();
+    events++;
+  }
+}
+
+/*******************************************************************************/
+/*** Picks a move by its rate and makes it ***/
+
+void nfoldEvent()
+{
+  PROFILE_START;
+
+  int move = findMove( uniformRandom()*rateSum() );
+  if( move>=(int)moveRate.size() || moveRate[move]==0.0 ){
+    // rounding in the tree; build it again and draw again
+    buildRateTree();
+    move = findMove( uniformRandom()*rateSum() );
+  }
+
+  int site = move/4;
+  iSite = site/N;
+  jSite = site%N;
+  oldCell = lattice[iSite][jSite][0];
+  newCell = moveNeighbour( iSite, jSite, move%4 );
+
+  flipChunk<0> chunk;
+  chunk.fill(iSite, jSite);
+  deltaEnergy = proposalEnergy( chunk );
+  PROFILE_LAP( PHASE_ENERGY );
+  commitFlip( chunk );
+  totalEnergy += deltaEnergy;
+  PROFILE_COUNT( PROFILE_ACCEPTED, 1 );
+
+  // rate again whatever can have changed, each site once
+  int stamp = ++nfoldEvents;
+  int i0 = iSite, j0 = jSite;
+  int cells[2] = { oldCell, newCell };
+
+  for(int di=-1;di<=1;di++)
+    for(int dj=-1;dj<=1;dj++){
+      int i = (N+i0+di)%N, j = (N+j0+dj)%N;
+      if(rateStamp[i*N+j]!=stamp){
+        rateStamp[i*N+j] = stamp;
+        rateSite(i,j);
+      }
+    }
+
+  for(int c=0;c<2;c++){
+    if(cells[c]==0)
+      continue;
+    for(int n=0;n<(int)cellPerimeterList[cells[c]].size();n++){
+      int pi = cellPerimeterList[cells[c]][n].first;
+      int pj = cellPerimeterList[cells[c]][n].second;
+      int around[5][2] = { {pi,pj}, {(pi+1)%N,pj}, {(N+pi-1)%N,pj}, {pi,(pj+1)%N}, {pi,(N+pj-1)%N} };
+      for(int k=0;k<5;k++){
+        int i = around[k][0], j = around[k][1];
+        if(rateStamp[i*N+j]!=stamp){
+          rateStamp[i*N+j] = stamp;
+          rateSite(i,j);
+        }
+      }
+    }
+  }
+
+  // the tree drifts as rates are added and taken away
+  if(nfoldEvents%4096==0)
+    buildRateTree();
+
+  PROFILE_LAP( PHASE_COMMIT );
+}
+
+/*******************************************************************************/
+/*** Works out the rates of the four moves of a site ***/
+
+void rateSite(int i, int j)
+{
+  int cell = lattice[i][j][0];
+  int lastNeighbour = cell;
+  double rate = 0.0;
+  bool valid = false;
+
+  for(int d=0;d<4;d++){
+    int neighbour = moveNeighbour(i,j,d);
+
+    // two neighbours in the same cell are the same move
+    if(neighbour!=lastNeighbour){
+      lastNeighbour = neighbour;
+      rate = 0.0;
+      valid = false;
+      if(neighbour!=cell){
+        iSite = i;
+        jSite = j;
+        oldCell = cell;
+        newCell = neighbour;
+        if( maintainsContiguity<0>() ){
+          flipChunk<0> chunk;
+          chunk.fill(i,j);
+          double energy = proposalEnergy( chunk );
+          rejectBlobular( oldCell );
+          rejectBlobular( newCell );
+          rate = energy<=0.0 ? 1.0 : exp(-beta*energy);
+          valid = true;
+        }
+      }
+    }
+    setRate( 4*(i*N+j)+d, neighbour!=cell ? rate : 0.0, neighbour!=cell && valid );
+  }
+}
+
+// the cell of a site's neighbour, in the directions choose() has them
+
+int moveNeighbour(int i, int j, int d)
+{
+  switch(d){
+    case 0:  return lattice[(i+1)%N][j][0];
+    case 1:  return lattice[(N+i-1)%N][j][0];
+    case 2:  return lattice[i][(j+1)%N][0];
+    default: return lattice[i][(N+j-1)%N][0];
+  }
+}
+
+/*******************************************************************************/
+/*** The binary indexed tree of rates ***/
+
+void setRate(int move, double rate, bool valid)
+{
+  validMoves += (int)valid - (int)moveValid[move];
+  moveValid[move] = valid;
+
+  double change = rate-moveRate[move];
+  if(change==0.0)
+    return;
+  moveRate[move] = rate;
+  if(rateTree.empty())
+    return;   // still being built
+  for(int k=move+1; k<(int)rateTree.size(); k+=k&-k)
+    rateTree[k] += change;
+}
+
+void buildRateTree()
+{
+  int size = moveRate.size();
+  rateTree.assign( size+1, 0.0 );
+  for(int k=1;k<=size;k++){
+    rateTree[k] += moveRate[k-1];
+    int parent = k+(k&-k);
+    if(parent<=size)
+      rateTree[parent] += rateTree[k];
+  }
+}
+
+double rateSum()
+{
+  double sum = 0.0;
+  for(int k=(int)rateTree.size()-1; k>0; k-=k&-k)
+    sum += rateTree[k];
+  return sum;
+}
+
+// the move whose stretch of the running total x falls in
+
+int findMove(double x)
+{
+  int size = (int)rateTree.size()-1;
+  int step = 1;
+  while(2*step<=size)
+    step *= 2;
+
+  int position = 0;
+  for(; step>0; step/=2){
+    if( position+step<=size && rateTree[position+step]<=x ){
+      position += step;
+      x -= rateTree[position];
+    }
+  }
+  return position;
+}
+
+/*******************************************************************************/
@@ -5,6 +5,9 @@
   void  printCells(char*);
   void  printLattice(char*);
   void  printCollagen(char*);
+  int   latticeLabel(int cell, bool perimeter, int collagen, int cells);
+
+  void  printStats(FILE*);   // potts_stats_.h
 
 /*******************************************************************************/
 /*** Prints a log file ***/
@@ -14,24 +17,44 @@ void printLog(char *fname)
   FILE *pfile;
   pfile=fopen(fname,"w");
   fprintf(pfile,"SEED\t\t%d\n\n",seed);
+  printRandom(pfile);
   fprintf(pfile,"LOOPS\t\t%d\n",numLoops);
   fprintf(pfile,"FLIPS\t\t%d\n",numFlips);
-  fprintf(pfile,"PRINT\t\t%d\n\n",numPrint);
+  fprintf(pfile,"PRINT\t\t%d\n",numPrint);
+  fprintf(pfile,"CHECKPOINT\t%d\n",checkpointEvery);
+  fprintf(pfile,"SNAPSHOT\t%d\n",snapshotFormat);
+  fprintf(pfile,"OUTPUT QUEUE\t%d\n",outputQueue);
+  fprintf(pfile,"OUTPUT STALLS\t%lu\n\n",writerStalls);
   fprintf(pfile,"CHUNKSIZE\t\t%d\n\n",chunkSize);
-  fprintf(pfile,"BETA\t\t%lf\n\n",beta);
+  fprintf(pfile,"THREADS\t\t%d\n\n",numThreads);
+  fprintf(pfile,"BETA\t\t%lf\n",beta);
+  if(numReplicas>1){
+    fprintf(pfile,"REPLICAS\t%d\n",numReplicas);
+    fprintf(pfile,"BETA MAX\t%lf\n",betaMax);
+    fprintf(pfile,"SWAP EVERY\t%d\n",swapEvery);
+  }
+  fprintf(pfile,"ACCEPTANCE\t%d\n",acceptance);
+  fprintf(pfile,"ENGINE\t\t%d\n\n",engine);
   fprintf(pfile,"AIR\t\t%lf\n",J_air);
   fprintf(pfile,"CELL\t\t%lf\n\n",J_cel);
   fprintf(pfile,"COLLAGEN\t%lf\n\n",J_col);
   fprintf(pfile,"VOLUME\t\t%lf\n",L_vol);
   fprintf(pfile,"ANISOTROPY\t%lf\n",L_ani);
+  fprintf(pfile,"ANISOTROPY MEASURE\t%d\n",anisotropyMeasure);
   fprintf(pfile,"BLOBULAR\t%lf\n\n",L_blb);
-  fprintf(pfile,"ADVANCEAMOUNT\t%d\n\n",advanceAmount);
+  // the blobular sample spacing of cell 1, what ADVANCEAMOUNT used to hold
+  fprintf(pfile,"ADVANCEAMOUNT\t%d\n\n", numCells>0 && !blobular.empty() ? blobular[1].spacing : advanceAmount);
   fprintf(pfile,"LATTICE EDGE\t%d\n",N);
   fprintf(pfile,"NUM CELLS\t%d\n",numCells);
   fprintf(pfile,"NUM COLLAGEN\t%d\n",numCollagen);
   fprintf(pfile,"CELL SPAWN\t%lf\n",cellSpawn);
+  fprintf(pfile,"SPAWN\t\t%d\n",spawnPacking);
   fprintf(pfile,"CELL RADIUS\t%lf\n",cellRadius);
   fprintf(pfile,"COLLAGEN WIDTH\t%d\n\n",collagenWidth);
+  printStats(pfile);
+  #if PROFILE
+  printProfile(pfile);
+  #endif
   fclose(pfile);
 }
 
@@ -59,32 +82,41 @@ void printCells(char *fname)
 
 void printLattice(char *fname)
 {
-  FILE *pfile;
-  pfile=fopen(fname,"w");
+  std::string text;
+  char site[16];
+
+  text.reserve( 4*N*N );
   for(int i=0;i<N;i++){
     for(int j=0;j<N;j++){
-      //air
-      if(lattice[i][j][0]==0){
-        if(lattice[i][j][1]==0)
-          fprintf(pfile,"%d ",0);
-        else
-          fprintf(pfile,"%d ",numCells+COLLAGEN_OFFSET);
-      }
-      //cell
-      else{
-    	for(std::set< std::pair<int, int> >::const_iterator it = cellPerimeterList[ lattice[i][j][0] ].begin(); it!=cellPerimeterList[ lattice[i][j][0] ].end(); ++it){
-    		if( (it->first == i) && (it->second == j) ){
-            fprintf(pfile,"%d ",lattice[i][j][0]+COLLAGEN_OFFSET+PERIMETER_OFFSET*numCells);
-            goto yep;
-          }
-        }
-        fprintf(pfile,"%d ",lattice[i][j][0]);
-        yep:;
-      }
+      int length = sprintf(site,"%d ",latticeLabel( lattice[i][j][0], isPerimeter(i,j), lattice[i][j][1], numCells ));
+      text.append( site, length );
     }
-    fprintf(pfile,"\n");
+    text += '\n';
+  }
+
+  // goes out through the writer thread, see potts_writer_.h
+  writeOutput( fname, text.data(), text.size(), false );
+}
+
+/*******************************************************************************/
+/*** The number a site is printed as in a text lattice ***/
+
+int latticeLabel(int cell, bool perimeter, int collagen, int cells)
+{
+  //air
+  if(cell==0){
+    if(collagen==0)
+      return 0;
+    else
+      return cells+COLLAGEN_OFFSET;
+  }
+  //cell
+  else{
+    if( perimeter )
+      return cell+COLLAGEN_OFFSET+PERIMETER_OFFSET*cells;
+    else
+      return cell;
   }
-  fclose(pfile);
 }
 
 /*******************************************************************************/
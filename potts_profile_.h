@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <chrono>
+#include <vector>
+
+/*******************************************************************************/
+/*** PROFILING FUNCTIONS ***/
+
+  enum profileCounter
+  {
+    PROFILE_PROPOSALS,      // sites drawn to flip
+    PROFILE_CONTIGUITY,     // ... and drawn again because the flip would split a cell
+    PROFILE_LOCKED,         // flips that waited because another thread had a cell
+    PROFILE_REJECTED,       // flips the Metropolis test turned down
+    PROFILE_ACCEPTED,
+    PROFILE_PERIMETERS,     // perimeters rebuilt from scratch
+    PROFILE_BLOBULAR,       // blobular caches rebuilt from scratch
+    PROFILE_COUNTERS
+  };
+
+  enum profilePhase
+  {
+    PHASE_PROPOSAL,         // choosing the flip
+    PHASE_ENERGY,           // working out its energy, up to the Metropolis test
+    PHASE_COMMIT,           // carrying it out, or dropping it
+    PHASE_OUTPUT,           // formatting the output and handing it to the writer
+    PHASE_WRITE,            // the writer thread writing it
+    PROFILE_PHASES
+  };
+
+  struct profileCounts
+  {
+    unsigned long count[PROFILE_COUNTERS];
+    double        seconds[PROFILE_PHASES];
+    char          padding[64];   // keeps the threads' counts off each other's cache lines
+  };
+
+  typedef std::chrono::steady_clock::time_point profileTime;
+
+  void  initProfile();
+  void  profileLap(int phase, profileTime &start);
+  void  sumProfile(profileCounts &total);
+  void  printProfile(FILE *pfile);
+  void  writeProfile(const char *fname);
+  char* profileKey(const char *name, char *key);
+
+  const char *profileCounterName[PROFILE_COUNTERS] =
+    { "PROPOSALS", "CONTIGUITY REJECTED", "LOCK WAITS", "METROPOLIS REJECTED",
+      "ACCEPTED", "PERIMETER REBUILDS", "BLOBULAR REBUILDS" };
+  const char *profilePhaseName[PROFILE_PHASES] =
+    { "PROPOSAL", "ENERGY", "COMMIT", "OUTPUT", "WRITE" };
+
+  profileCounts mainProfile;                  // everything serial
+  profileCounts writerProfile;                // the writer thread
+  std::vector<profileCounts> threadProfiles;  // one per sweep thread
+
+  thread_local profileCounts *threadProfile = &mainProfile;
+
+/*
+    With PROFILE 1 the run counts where its flips go and times the
+    phases of each, and adds it all to aaa_log_.txt and to
+    aaa_profile_.json (one object of counts, one of seconds, keys in
+    lower case with _ for spaces).  Every thread counts into its own
+    profileCounts, the way it draws from its own random stream, so
+    nothing is shared on the hot path.
+
+    PROFILE_COUNT(counter,n) adds n to a counter.  PROFILE_START starts
+    a stopwatch in the current scope, and PROFILE_LAP(phase) adds the
+    time since the start or the last lap to phase.  With PROFILE 0 they
+    are all nothing at all.  The stopwatch is std::chrono::steady_clock,
+    which costs a few tens of ns a lap; that is noticeable on the fast
+    paths, which is why it isn't on by default.
+*/
+
+#if PROFILE
+  #define PROFILE_COUNT(counter,n)  threadProfile->count[counter] += (n)
+  #define PROFILE_START             profileTime profileStart = std::chrono::steady_clock::now()
+  #define PROFILE_LAP(phase)        profileLap( phase, profileStart )
+#else
+  #define PROFILE_COUNT(counter,n)
+  #define PROFILE_START
+  #define PROFILE_LAP(phase)
+#endif
+
+/*******************************************************************************/
+/*** Zeroes every count ***/
+
+void initProfile()
+{
+  profileCounts zero = profileCounts();
+
+  mainProfile = zero;
+  writerProfile = zero;
+  threadProfiles.assign( numThreads, zero );
+  threadProfile = &mainProfile;
+}
+
+/*******************************************************************************/
+/*** Adds the time since start to a phase, and starts again ***/
+
+void profileLap(int phase, profileTime &start)
+{
+  profileTime now = std::chrono::steady_clock::now();
+  threadProfile->seconds[phase] += std::chrono::duration<double>(now-start).count();
+  start = now;
+}
+
+/*******************************************************************************/
+/*** Adds up the counts of every thread ***/
+
+void sumProfile(profileCounts &total)
+{
+  total = mainProfile;
+  for(int t=0;t<=(int)threadProfiles.size();t++){
+    profileCounts &p = t<(int)threadProfiles.size() ? threadProfiles[t] : writerProfile;
+    for(int c=0;c<PROFILE_COUNTERS;c++)
+      total.count[c] += p.count[c];
+    for(int s=0;s<PROFILE_PHASES;s++)
+      total.seconds[s] += p.seconds[s];
+  }
+}
+
+/*******************************************************************************/
+/*** Prints the counts for the log ***/
+
+void printProfile(FILE *pfile)
+{
+  profileCounts total;
+  sumProfile(total);
+
+  for(int c=0;c<PROFILE_COUNTERS;c++)
+    fprintf(pfile,"%s\t%lu\n",profileCounterName[c],total.count[c]);
+  fprintf(pfile,"\n");
+  for(int s=0;s<PROFILE_PHASES;s++)
+    fprintf(pfile,"TIME %s\t%.6lf\n",profilePhaseName[s],total.seconds[s]);
+  fprintf(pfile,"\n");
+}
+
+/*******************************************************************************/
+/*** Writes the counts as JSON ***/
+
+void writeProfile(const char *fname)
+{
+  profileCounts total;
+  sumProfile(total);
+
+  FILE *pfile=fopen(fname,"w");
+  if(pfile==NULL)
+    return;
+
+  char key[100];
+
+  fprintf(pfile,"{\n  \"counts\": {\n");
+  for(int c=0;c<PROFILE_COUNTERS;c++)
+    fprintf(pfile,"    \"%s\": %lu%s\n",profileKey(profileCounterName[c],key),
+            total.count[c], c+1<PROFILE_COUNTERS ? "," : "");
+  fprintf(pfile,"  },\n  \"seconds\": {\n");
+  for(int s=0;s<PROFILE_PHASES;s++)
+    fprintf(pfile,"    \"%s\": %.6lf%s\n",profileKey(profilePhaseName[s],key),
+            total.seconds[s], s+1<PROFILE_PHASES ? "," : "");
+  fprintf(pfile,"  },\n  \"threads\": %d\n}\n",numThreads);
+
+  fclose(pfile);
+}
+
+// "LOCK WAITS" as "lock_waits"
+
+char* profileKey(const char *name, char *key)
+{
+  int n = 0;
+  for(; name[n]; n++)
+    key[n] = name[n]==' ' ? '_' : tolower(name[n]);
+  key[n] = '\0';
+  return key;
+}
+
+/*******************************************************************************/
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+/*******************************************************************************/
+/*** RANDOM NUMBER FUNCTIONS ***/
+
+  #define RANDOM_BATCH 64   // uniforms made at a time by uniformRandom()
+
+  struct randomStream
+  {
+    #if RANDOM_GENERATOR
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t block[4];      // last Philox output, used up two words at a time
+    int      blockUsed;
+    #else
+    uint64_t s[4];
+    #endif
+    double   uniform[RANDOM_BATCH];
+    int      uniformUsed;
+    double   threshold[RANDOM_BATCH];
+    int      thresholdUsed;
+  };
+
+  void      initRandom();
+  void      seedStream(randomStream &r, uint64_t seed, int stream);
+  uint64_t  nextRandom(randomStream &r);
+  void      fillUniform(randomStream &r, double *u, int count);
+  int       randomInt(int n);
+  double    uniformRandom();
+  double    thresholdRandom();
+  void      printRandom(FILE *pfile);
+
+  randomStream mainStream;                  // everything serial
+  std::vector<randomStream> threadStreams;  // one per sweep thread
+
+  // the stream of whatever this thread is doing; the sweeps point it
+  // at their own stream and back again
+  thread_local randomStream *threadStream = &mainStream;
+
+/*
+    RANDOM_GENERATOR picks the generator, xoshiro256** (0) or Philox4x32-10
+    (1).  Both give any number of independent, reproducible streams from
+    one seed: xoshiro by jumping 2^128 numbers ahead per stream, Philox by
+    putting the stream number in the counter.  Stream 0 is mainStream,
+    stream 1+t belongs to sweep thread t, so a run is repeated exactly by
+    its SEED and THREADS.
+
+    uniformRandom() hands out doubles in [0,1) from a buffer filled
+    RANDOM_BATCH at a time, randomInt(n) an int in [0,n), and
+    thresholdRandom() -log of a uniform, likewise made in batches.
+*/
+
+/*******************************************************************************/
+/*** Seeds the main stream and one stream per thread ***/
+
+void initRandom()
+{
+  seedStream( mainStream, seed, 0 );
+
+  threadStreams.resize( numThreads );
+  for(int t=0;t<numThreads;t++)
+    seedStream( threadStreams[t], seed, 1+t );
+
+  threadStream = &mainStream;
+}
+
+/*******************************************************************************/
+/*** Starts stream number 'stream' of the given seed ***/
+
+void seedStream(randomStream &r, uint64_t seed, int stream)
+{
+  #if RANDOM_GENERATOR
+
+  r.key[0] = (uint32_t)seed;
+  r.key[1] = (uint32_t)(seed>>32);
+  r.counter[0] = 0;
+  r.counter[1] = 0;
+  r.counter[2] = (uint32_t)stream;
+  r.counter[3] = 0;
+  r.blockUsed = 4;
+
+  #else
+
+  // splitmix64 of the seed, so that small seeds still give busy states
+  uint64_t z = seed;
+  for(int n=0;n<4;n++){
+    z += 0x9e3779b97f4a7c15ull;
+    uint64_t x = z;
+    x = (x^(x>>30))*0xbf58476d1ce4e5b9ull;
+    x = (x^(x>>27))*0x94d049bb133111ebull;
+    r.s[n] = x^(x>>31);
+  }
+
+  static const uint64_t jump[4] = { 0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull,
+                                    0xa9582618e03fc9aaull, 0x39abdc4529b1661cull };
+  for(int k=0;k<stream;k++){
+    uint64_t t[4] = { 0, 0, 0, 0 };
+    for(int w=0;w<4;w++){
+      for(int b=0;b<64;b++){
+        if( jump[w] & ((uint64_t)1<<b) )
+          for(int n=0;n<4;n++)
+            t[n] ^= r.s[n];
+        nextRandom(r);
+      }
+    }
+    for(int n=0;n<4;n++)
+      r.s[n] = t[n];
+  }
+
+  #endif
+
+  r.uniformUsed = RANDOM_BATCH;
+  r.thresholdUsed = RANDOM_BATCH;
+}
+
+/*******************************************************************************/
+/*** The next 64 random bits of a stream ***/
+
+#if RANDOM_GENERATOR
+
+void philoxBlock(randomStream &r)
+{
+  uint32_t c[4] = { r.counter[0], r.counter[1], r.counter[2], r.counter[3] };
+  uint32_t k[2] = { r.key[0], r.key[1] };
+
+  for(int round=0;round<10;round++){
+    uint64_t p0 = (uint64_t)0xD2511F53u*c[0];
+    uint64_t p1 = (uint64_t)0xCD9E8D57u*c[2];
+    uint32_t c0 = (uint32_t)(p1>>32)^c[1]^k[0];
+    uint32_t c2 = (uint32_t)(p0>>32)^c[3]^k[1];
+    c[1] = (uint32_t)p1;
+    c[3] = (uint32_t)p0;
+    c[0] = c0;
+    c[2] = c2;
+    k[0] += 0x9E3779B9u;
+    k[1] += 0xBB67AE85u;
+  }
+
+  for(int n=0;n<4;n++)
+    r.block[n] = c[n];
+  r.blockUsed = 0;
+
+  if(++r.counter[0]==0)
+    r.counter[1]++;
+}
+
+uint64_t nextRandom(randomStream &r)
+{
+  if(r.blockUsed>=4)
+    philoxBlock(r);
+  uint64_t x = ((uint64_t)r.block[r.blockUsed]<<32) | r.block[r.blockUsed+1];
+  r.blockUsed += 2;
+  return x;
+}
+
+#else
+
+uint64_t nextRandom(randomStream &r)
+{
+  uint64_t x = r.s[1]*5;
+  x = ((x<<7)|(x>>57))*9;
+
+  uint64_t t = r.s[1]<<17;
+  r.s[2] ^= r.s[0];
+  r.s[3] ^= r.s[1];
+  r.s[1] ^= r.s[2];
+  r.s[0] ^= r.s[3];
+  r.s[2] ^= t;
+  r.s[3] = (r.s[3]<<45)|(r.s[3]>>19);
+
+  return x;
+}
+
+#endif
+
+/*******************************************************************************/
+/*** Fills u with count doubles in [0,1) ***/
+
+void fillUniform(randomStream &r, double *u, int count)
+{
+  for(int n=0;n<count;n++)
+    u[n] = (double)(nextRandom(r)>>11)*(1.0/9007199254740992.0);
+}
+
+/*******************************************************************************/
+/*** Draws from this thread's stream ***/
+
+// n*x/2^32 rather than x%n: no division, and no noticeable bias for the
+// n used here (lattice edges, cell counts, 2, 4)
+
+int randomInt(int n)
+{
+  return (int)( ((nextRandom(*threadStream)>>32)*(uint64_t)n)>>32 );
+}
+
+double uniformRandom()
+{
+  randomStream &r = *threadStream;
+  if(r.uniformUsed>=RANDOM_BATCH){
+    fillUniform( r, r.uniform, RANDOM_BATCH );
+    r.uniformUsed = 0;
+  }
+  return r.uniform[ r.uniformUsed++ ];
+}
+
+// a flip with beta*deltaEnergy below this is accepted with probability
+// exp(-beta*deltaEnergy), without calling exp()
+
+double thresholdRandom()
+{
+  randomStream &r = *threadStream;
+  if(r.thresholdUsed>=RANDOM_BATCH){
+    fillUniform( r, r.threshold, RANDOM_BATCH );
+    for(int n=0;n<RANDOM_BATCH;n++)
+      r.threshold[n] = -log( r.threshold[n] );
+    r.thresholdUsed = 0;
+  }
+  return r.threshold[ r.thresholdUsed++ ];
+}
+
+/*******************************************************************************/
+/*** Prints the generator and where every stream is, for the log ***/
+
+void printRandom(FILE *pfile)
+{
+  #if RANDOM_GENERATOR
+  fprintf(pfile,"GENERATOR\tphilox4x32-10\n");
+  #else
+  fprintf(pfile,"GENERATOR\txoshiro256**\n");
+  #endif
+
+  for(int t=0;t<=(int)threadStreams.size();t++){
+    randomStream &r = t==0 ? mainStream : threadStreams[t-1];
+    fprintf(pfile,"STREAM %d\t",t);
+    #if RANDOM_GENERATOR
+    fprintf(pfile,"%08x %08x %08x %08x %08x %08x %d",r.key[0],r.key[1],
+            r.counter[0],r.counter[1],r.counter[2],r.counter[3],r.blockUsed);
+    #else
+    fprintf(pfile,"%016llx %016llx %016llx %016llx",(unsigned long long)r.s[0],
+            (unsigned long long)r.s[1],(unsigned long long)r.s[2],(unsigned long long)r.s[3]);
+    #endif
+    fprintf(pfile," %d %d\n",r.uniformUsed,r.thresholdUsed);
+  }
+  fprintf(pfile,"\n");
+}
+
+/*******************************************************************************/
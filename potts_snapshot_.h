@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/*******************************************************************************/
+/*** SNAPSHOT FUNCTIONS ***/
+
+  struct snapshot
+  {
+    int N, numCells, step;
+    std::vector<int>  cell;       // upper lattice, site i*N+j
+    std::vector<char> perimeter;  // 1 on a cell's perimeter
+    std::vector<int>  collagen;   // lower lattice
+  };
+
+  void  saveLattice(const char *dname, int n);
+  void  writeSnapshot(const char *fname, int step);
+  bool  readSnapshot(const char *fname, snapshot &s);
+  bool  importSnapshot(const char *fname);
+  void  exportSnapshot(const char *from, const char *to);
+  void  putVarint(std::vector<unsigned char> &buf, unsigned int v);
+  bool  getVarint(const unsigned char *&p, const unsigned char *end, unsigned int &v);
+
+/*
+    A snapshot (lattice_<n>_.snap) holds everything a text lattice does,
+    and the collagen as well, in a fraction of the space and time:
+
+      "PSNP", then version, N, numCells, step as 32 bit ints
+      cell ids       as (run length, id) pairs
+      perimeter      as run lengths, off and on in turn, starting off
+      collagen       as (run length, value) pairs
+
+    with every number a varint (7 bits a byte, low bits first, high bit
+    set on all but the last byte).  Lattices are mostly long runs of one
+    cell or of air, so this typically comes to a few kB.
+
+    SNAPSHOT 0 prints the text lattices as before; potts -x turns a
+    snapshot into one of those.
+*/
+
+/*******************************************************************************/
+/*** Saves lattice number n in the chosen format ***/
+
+void saveLattice(const char *dname, int n)
+{
+  char fname[400];
+
+  if(snapshotFormat==0){
+    sprintf(fname,"%s/lattice_%d_.txt",dname,n);
+    printLattice(fname);
+  }
+  else{
+    sprintf(fname,"%s/lattice_%d_.snap",dname,n);
+    writeSnapshot(fname,n);
+  }
+}
+
+/*******************************************************************************/
+/*** Writes the lattice as a snapshot ***/
+
+void writeSnapshot(const char *fname, int step)
+{
+  std::vector<unsigned char> buf;
+  buf.reserve( 4096 );
+
+  const char magic[4] = { 'P', 'S', 'N', 'P' };
+  int header[4] = { 1, N, numCells, step };
+  buf.insert( buf.end(), magic, magic+4 );
+  buf.insert( buf.end(), (unsigned char*)header, (unsigned char*)(header+4) );
+
+  for(int layer=0;layer<2;layer++){
+    int value = lattice[0][0][layer];
+    unsigned int run = 0;
+    for(int i=0;i<N;i++){
+      for(int j=0;j<N;j++){
+        if(lattice[i][j][layer]!=value){
+          putVarint( buf, run );
+          putVarint( buf, value );
+          value = lattice[i][j][layer];
+          run = 0;
+        }
+        run++;
+      }
+    }
+    putVarint( buf, run );
+    putVarint( buf, value );
+
+    if(layer==1)
+      break;
+
+    // the perimeter goes between the two layers
+    bool on = false;
+    run = 0;
+    for(int i=0;i<N;i++){
+      for(int j=0;j<N;j++){
+        if(isPerimeter(i,j)!=on){
+          putVarint( buf, run );
+          on = !on;
+          run = 0;
+        }
+        run++;
+      }
+    }
+    putVarint( buf, run );
+  }
+
+  writeOutput( fname, (const char*)&buf[0], buf.size(), false );
+}
+
+/*******************************************************************************/
+/*** Reads a snapshot, returns false if it isn't one ***/
+
+bool readSnapshot(const char *fname, snapshot &s)
+{
+  FILE* inFile=fopen(fname,"rb");
+  if(inFile==NULL)
+    return false;
+
+  std::vector<unsigned char> buf;
+  unsigned char block[65536];
+  size_t got;
+  while( (got=fread(block,1,sizeof(block),inFile))>0 )
+    buf.insert( buf.end(), block, block+got );
+  fclose(inFile);
+
+  int header[4];
+  if( buf.size()<4+sizeof(header) || memcmp(&buf[0],"PSNP",4)!=0 )
+    return false;
+  memcpy( header, &buf[4], sizeof(header) );
+  if( header[0]!=1 || header[1]<=0 )
+    return false;
+
+  s.N = header[1];
+  s.numCells = header[2];
+  s.step = header[3];
+
+  int sites = s.N*s.N;
+  s.cell.assign( sites, 0 );
+  s.perimeter.assign( sites, 0 );
+  s.collagen.assign( sites, 0 );
+
+  const unsigned char *p = &buf[0]+4+sizeof(header);
+  const unsigned char *end = &buf[0]+buf.size();
+  unsigned int run, value;
+
+  for(int layer=0;layer<2;layer++){
+    std::vector<int> &site = layer==0 ? s.cell : s.collagen;
+    for(int n=0;n<sites;){
+      if( !getVarint(p,end,run) || !getVarint(p,end,value) || run>(unsigned int)(sites-n) )
+        return false;
+      for(unsigned int k=0;k<run;k++)
+        site[n++] = value;
+    }
+
+    if(layer==1)
+      break;
+
+    char on = 0;
+    for(int n=0;n<sites;){
+      if( !getVarint(p,end,run) || run>(unsigned int)(sites-n) )
+        return false;
+      for(unsigned int k=0;k<run;k++)
+        s.perimeter[n++] = on;
+      on = !on;
+    }
+  }
+
+  return true;
+}
+
+/*******************************************************************************/
+/*** Puts a snapshot on the lattice, returns false if there is none ***/
+
+bool importSnapshot(const char *fname)
+{
+  snapshot s;
+
+  if( !readSnapshot(fname,s) )
+    return false;
+  if( s.N!=N || s.numCells!=numCells ){
+    printf("\n Nope... %s is %d cells on %d x %d\n\n",fname,s.numCells,s.N,s.N);
+    exit(1);
+  }
+
+  for(int i=0;i<N;i++){
+    for(int j=0;j<N;j++){
+      lattice[i][j][0] = s.cell[i*N+j];
+      lattice[i][j][1] = s.collagen[i*N+j];
+      if(lattice[i][j][0]>0)
+        addVolume( i, j, lattice[i][j][0] );
+    }
+  }
+  calculatePerimeters();
+
+  return true;
+}
+
+/*******************************************************************************/
+/*** Writes a snapshot out as a text lattice, like printLattice() ***/
+
+void exportSnapshot(const char *from, const char *to)
+{
+  snapshot s;
+
+  if( !readSnapshot(from,s) ){
+    printf("\n Nope... %s is not a snapshot\n\n",from);
+    exit(1);
+  }
+
+  FILE *pfile;
+  pfile=fopen(to,"w");
+  if(pfile==NULL){
+    printf("\n Nope... can't write %s\n\n",to);
+    exit(1);
+  }
+  for(int i=0;i<s.N;i++){
+    for(int j=0;j<s.N;j++){
+      int n = i*s.N+j;
+      fprintf(pfile,"%d ",latticeLabel( s.cell[n], s.perimeter[n], s.collagen[n], s.numCells ));
+    }
+    fprintf(pfile,"\n");
+  }
+  fclose(pfile);
+}
+
+/*******************************************************************************/
+/*** Varints ***/
+
+void putVarint(std::vector<unsigned char> &buf, unsigned int v)
+{
+  while(v>=0x80){
+    buf.push_back( (unsigned char)(v|0x80) );
+    v >>= 7;
+  }
+  buf.push_back( (unsigned char)v );
+}
+
+bool getVarint(const unsigned char *&p, const unsigned char *end, unsigned int &v)
+{
+  v = 0;
+  for(int shift=0; p<end && shift<35; shift+=7){
+    v |= (unsigned int)(*p&0x7f)<<shift;
+    if( (*p++&0x80)==0 )
+      return true;
+  }
+  return false;
+}
+
+/*******************************************************************************/
@@ -1,5 +1,7 @@
+#include <math.h>
+#include <algorithm>
 #include <utility>
-#include <set>
+#include <vector>
 
 /*******************************************************************************/
 /*** CREATION FUNCTIONS ***/
@@ -8,7 +10,8 @@
   void  readCollagen();
   void  putCells();
   void  putCellsHelper(int, int, int);
-  void  calculatePerimeter(int);
+  void  putAggregate();
+  void  calculatePerimeters();
   void  putCollagen();
   void  putCollagenHelper(int, int, double);
 
@@ -29,13 +32,12 @@ void readCells()
       if(lattice[i][j][0]>numCells)
         lattice[i][j][0]-=COLLAGEN_OFFSET+PERIMETER_OFFSET*numCells;
       if(lattice[i][j][0]>0){
-        cellVolumeList[lattice[i][j][0]].insert( std::make_pair(i, j) );
+        addVolume( i, j, lattice[i][j][0] );
       }
     }
   }
   fclose(inFile);
-  for(int cell=1;cell<=numCells; cell++)
-    calculatePerimeter(cell);
+  calculatePerimeters();
 }
 
 /*******************************************************************************/
@@ -62,11 +64,48 @@ void putCells()
 {
   if(numCells==1)
     putCellsHelper(N/2,N/2,1);
+  else if(spawnPacking==1)
+    putAggregate();
   else
     for(int cell=1; cell<=numCells; cell++)
-      putCellsHelper(rand()%N,rand()%N,cell);
-  for(int cell=1;cell<=numCells; cell++)
-    calculatePerimeter(cell);
+      putCellsHelper(randomInt(N),randomInt(N),cell);
+  calculatePerimeters();
+}
+
+/*******************************************************************************/
+/*** Packs the cells into an aggregate in the middle of the lattice ***/
+
+// Dropped at random, thousands of cells land on top of each other and
+// the ones underneath are lost.  These go on a hexagonal grid, far
+// enough apart not to touch (across the edges either), nearest the
+// middle first, so cell 1 is in the middle and the last ones on the
+// outside.
+
+void putAggregate()
+{
+  int spacing = (int)(2.0*cellSpawn)+2;
+  int rowStep = (int)ceil( spacing*sqrt(3.0)/2.0 );
+  int reach = N/2-(spacing+1)/2;
+
+  std::vector< std::pair<int, std::pair<int, int> > > spots;
+  for(int k=-reach/rowStep; k<=reach/rowStep; k++){
+    int dx = k*rowStep;
+    int shift = k%2!=0 ? spacing/2 : 0;
+    for(int m=-(reach+shift)/spacing; m<=(reach-shift)/spacing; m++){
+      int dy = shift+m*spacing;
+      spots.push_back( std::make_pair( dx*dx+dy*dy, std::make_pair(dx,dy) ) );
+    }
+  }
+
+  if( (int)spots.size()<numCells ){
+    printf("\n Nope... only %d cells of CELL SPAWN %lf fit on the lattice, not %d\n\n",
+           (int)spots.size(),cellSpawn,numCells);
+    exit(1);
+  }
+  std::sort( spots.begin(), spots.end() );
+
+  for(int cell=1; cell<=numCells; cell++)
+    putCellsHelper( (N+N/2+spots[cell-1].second.first)%N, (N+N/2+spots[cell-1].second.second)%N, cell );
 }
 
 /*******************************************************************************/
@@ -79,7 +118,7 @@ void putCellsHelper(int x0, int y0, int cell)
     for(int y=-ymax; y<=ymax; y++){
       if(lattice[(N+x0+x)%N][(N+y0+y)%N][0]==0){
 		lattice[(N+x0+x)%N][(N+y0+y)%N][0]=cell;
-		cellVolumeList[ cell ].insert( std::make_pair( (N+x0+x)%N , (N+y0+y)%N ) ); 
+		addVolume( (N+x0+x)%N , (N+y0+y)%N , cell );
       }
     }
   }
@@ -88,17 +127,20 @@ void putCellsHelper(int x0, int y0, int cell)
 /*******************************************************************************/
 /*** Calculates cell perimeters ***/
 
-void calculatePerimeter(int cell)
+// every cell's, from the boundary mask (see potts_kernels_.h); the
+// sites go in each perimeter list in the order of the volume list
+
+void calculatePerimeters()
 {
-  for( std::set< std::pair<int, int> >::const_iterator it = cellVolumeList[cell].begin(); it!= cellVolumeList[cell].end(); ++it){ 
-	int i = it->first;
-	int j = it->second;
-    if( lattice[i][j][0]!=lattice[(i+1)%N][j][0] ||
-        lattice[i][j][0]!=lattice[i][(j+1)%N][0] || 
-        lattice[i][j][0]!=lattice[(N+i-1)%N][j][0] || 
-        lattice[i][j][0]!=lattice[i][(N+j-1)%N][0] )
-    {
-	  cellPerimeterList[ cell ].insert( std::make_pair(i, j) );
+  PROFILE_COUNT( PROFILE_PERIMETERS, numCells );
+  packLattice();
+  boundaryMask();
+  for(int cell=1;cell<=numCells;cell++){
+    for( int n = 0; n < (int)cellVolumeList[cell].size(); n++ ){
+      int i = cellVolumeList[cell][n].first;
+      int j = cellVolumeList[cell][n].second;
+      if( split.boundary[i*N+j] )
+        addPerimeter( i, j, cell );
     }
   }
 }
@@ -109,9 +151,9 @@ void calculatePerimeter(int cell)
 void putCollagen()
 {
   for(int n=0; n<numCollagen; n++){
-    int x = rand()%N;
-    int y = rand()%N;
-    double m = tan((double)rand()/((double)RAND_MAX*2.0/3.14159));
+    int x = randomInt(N);
+    int y = randomInt(N);
+    double m = tan(uniformRandom()*3.14159/2.0);
     putCollagenHelper(x,y,m);
   }
 }
@@ -121,8 +163,8 @@ void putCollagen()
 
 void putCollagenHelper(int x0, int y0, double slope)
 {
-  int sx = 2*(rand()%2)-1;
-  int sy = 2*(rand()%2)-1;
+  int sx = 2*randomInt(2)-1;
+  int sy = 2*randomInt(2)-1;
   for(int i=0;i<collagenWidth;i++){
     int x  = x0+i*sy;
     int y  = y0-i*sx;
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <string>
+
+/*******************************************************************************/
+/*** RUN STATISTICS FUNCTIONS ***/
+
+  struct runningStats
+  {
+    enum { LAGS = 64, LEVELS = 32 };
+
+    long   n;
+    double shift;                  // the first value, taken off the rest
+    double mean, m2;               // Welford
+
+    double recent[LAGS];           // the last LAGS values, x(t) at t%LAGS
+    double product[LAGS];          // sum of x(t)*x(t-k)
+    double lead[LAGS], lag[LAGS];  // sum of x(t) and of x(t-k)
+
+    long   blocks[LEVELS];         // Welford over blocks of 2^level values
+    double blockMean[LEVELS], blockM2[LEVELS];
+    double pending[LEVELS];        // the first half of the next block
+    int    hasPending[LEVELS];
+
+    void   add(double x);
+    void   addBlock(int level, double x);
+    double deviation() const;
+    double autocorrelationTime(bool &converged) const;
+    double error() const;
+  };
+
+  enum statsObservable
+  {
+    STATS_ENERGY,
+    STATS_ACCEPTANCE,
+    STATS_VOLUME,          // averaged over the cells
+    STATS_PERIMETER,
+    STATS_ANISOTROPY,
+    STATS_OBSERVABLES
+  };
+
+  const char *statsName[STATS_OBSERVABLES] =
+    { "ENERGY", "ACCEPTANCE", "VOLUME", "PERIMETER", "ANISOTROPY" };
+
+  runningStats runStats[STATS_OBSERVABLES];
+
+  void  initStats();
+  void  addStats(double acceptance);
+  void  printStats(FILE *pfile);
+  void  writeShapes(const char *fname, int loop);
+
+/*
+    Every loop the energy, the acceptance and the cell averages of
+    avg[] go into a runningStats each, which keeps
+
+      the mean and standard deviation (Welford's update, so no sums of
+      squares to lose digits in),
+
+      the autocorrelation of the last LAGS loops, from which the
+      integrated autocorrelation time comes, summed up to Sokal's window
+      of 5 times itself (marked with > in the log if LAGS loops weren't
+      enough),
+
+      the mean of every level of blocking, pairs of loops, pairs of
+      those and so on (Flyvbjerg and Petersen), whose spread gives the
+      error of the mean allowing for the correlations; the largest over
+      the levels with at least 32 blocks is the one printed.
+
+    None of it keeps the series, it costs O(LAGS) a loop, and it goes
+    in the checkpoint, so a resumed run ends with the same statistics.
+    They are printed to aaa_log_.txt.
+
+    avg[] itself is kept up by measureCells() every loop, which only
+    measures again the cells a flip has changed.  The shape of every
+    cell goes to aaa_shapes_.txt every loop, a line of
+
+      loop  volume perimeter anisotropy  (for cell 1, 2, ...)
+*/
+
+/*******************************************************************************/
+/*** Starts the statistics over ***/
+
+void initStats()
+{
+  memset( runStats, 0, sizeof(runStats) );
+}
+
+/*******************************************************************************/
+/*** Adds a loop's values ***/
+
+void addStats(double acceptance)
+{
+  runStats[STATS_ENERGY].add( totalEnergy );
+  runStats[STATS_ACCEPTANCE].add( acceptance );
+  runStats[STATS_VOLUME].add( avg[0] );
+  runStats[STATS_PERIMETER].add( avg[1] );
+  runStats[STATS_ANISOTROPY].add( avg[2] );
+}
+
+void runningStats::add(double value)
+{
+  if(n==0)
+    shift = value;
+  double x = value-shift;
+
+  n++;
+  double delta = x-mean;
+  mean += delta/n;
+  m2 += delta*(x-mean);
+
+  recent[ (n-1)%LAGS ] = x;
+  for(int k=0; k<LAGS && k<n; k++){
+    double before = recent[ (n-1-k)%LAGS ];
+    product[k] += x*before;
+    lead[k] += x;
+    lag[k] += before;
+  }
+
+  addBlock( 0, x );
+}
+
+// a block of 2^level values, averaged
+
+void runningStats::addBlock(int level, double x)
+{
+  blocks[level]++;
+  double delta = x-blockMean[level];
+  blockMean[level] += delta/blocks[level];
+  blockM2[level] += delta*(x-blockMean[level]);
+
+  if(level+1>=LEVELS)
+    return;
+  if(hasPending[level]){
+    hasPending[level] = 0;
+    addBlock( level+1, 0.5*(pending[level]+x) );
+  }
+  else{
+    pending[level] = x;
+    hasPending[level] = 1;
+  }
+}
+
+/*******************************************************************************/
+/*** What the statistics come to ***/
+
+double runningStats::deviation() const
+{
+  return n>1 ? sqrt(m2/(n-1)) : 0.0;
+}
+
+// in loops; converged is false if the window ran past the lags kept
+
+double runningStats::autocorrelationTime(bool &converged) const
+{
+  double tau = 0.5;
+  converged = false;
+
+  double c0 = n>0 ? (product[0]-lead[0]*lag[0]/n)/n : 0.0;
+  if(c0<=0.0)
+    return tau;
+
+  for(int k=1; k<LAGS && k<n; k++){
+    long pairs = n-k;
+    double ck = (product[k]-lead[k]*lag[k]/pairs)/pairs;
+    tau += ck/c0;
+    if( k>=5.0*tau ){
+      converged = true;
+      break;
+    }
+  }
+  return tau;
+}
+
+// of the mean
+
+double runningStats::error() const
+{
+  double largest = 0.0;
+  for(int level=0; level<LEVELS && blocks[level]>=32; level++){
+    double e = sqrt( blockM2[level]/((double)blocks[level]*(blocks[level]-1)) );
+    if(e>largest)
+      largest = e;
+  }
+  return largest;
+}
+
+/*******************************************************************************/
+/*** Prints the statistics for the log ***/
+
+void printStats(FILE *pfile)
+{
+  fprintf(pfile,"STATISTICS\tmean\tdeviation\terror\ttau (loops)\n");
+  for(int s=0;s<STATS_OBSERVABLES;s++){
+    const runningStats &r = runStats[s];
+    bool converged;
+    double tau = r.autocorrelationTime(converged);
+    fprintf(pfile,"%s\t%lf\t%lf\t%lf\t%s%.2lf\n",statsName[s],r.shift+r.mean,r.deviation(),
+            r.error(),converged ? "" : ">",tau);
+  }
+  fprintf(pfile,"LOOPS MEASURED\t%ld\n\n",runStats[STATS_ENERGY].n);
+}
+
+/*******************************************************************************/
+/*** Adds every cell's shape to the time series ***/
+
+void writeShapes(const char *fname, int loop)
+{
+  char   line[64];
+  int    length;
+  std::string text;
+
+  length = sprintf(line,"%5d ",loop);
+  text.append( line, length );
+  for(int cell=1;cell<=numCells;cell++){
+    length = sprintf(line," %6d %5d %8.3lf",(int)cellVolumeList[cell].size(),
+                     (int)cellPerimeterList[cell].size(),cellAnisotropy[cell]);
+    text.append( line, length );
+  }
+  text += '\n';
+  writeOutput( fname, text.data(), text.size(), true );
+}
+
+/*******************************************************************************/
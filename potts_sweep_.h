@@ -0,0 +1,360 @@
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*******************************************************************************/
+/*** PARALLEL SWEEP FUNCTIONS ***/
+
+  void  initSweeps();
+  int   sweep(int proposals);
+  int   tileFlip(int tile, int i0, int j0, int height, int width);
+  void  listTileSites(int offsetI, int offsetJ, int color);
+  int   tileOf(int i, int j, int offsetI, int offsetJ);
+  bool  lockCells(int *cells, int count);
+  void  unlockCells(int *cells, int count);
+
+  int   numTiles = 0;                   // tiles along each side of the lattice, even
+  std::vector< std::vector<int> > tileSites;  // perimeter sites (i*N+j) of every tile
+  std::vector<int> tileStamp;           // the listing a site was last put in a tile by
+  int   tileListing = 0;
+  #ifdef _OPENMP
+  std::vector<omp_lock_t> cellLocks;
+  #endif
+
+/*
+    With numThreads > 1 the lattice is cut into numTiles x numTiles tiles
+    and coloured like a 2x2 checkerboard.  All tiles of one colour are
+    worked on at the same time, one thread per tile, then the next colour,
+    and so on.  Two tiles of a colour are a whole tile apart, so as long
+    as a tile is wider than everything one flip reads or writes around its
+    site (the chunk, its neighbors, their neighbors) the flips cannot see
+    each other on the lattice.
+
+    A tile draws its flips like choose() does, from perimeter sites, and
+    draws again when the flip would split a cell, so a sweep of FLIPS
+    proposals goes as far as FLIPS calls to flip().  Every tile keeps a
+    list of the cell perimeter sites in it, and the proposals are shared
+    out among the tiles by the length of their lists.  choose() picks a
+    cell first and then one of its sites, the tiles pick a site straight
+    away, which is the same with one cell and close to it with many of
+    about the same size.
+
+    Cells are bigger than tiles though, and the volume, perimeter and
+    blobular energy of a cell belong to the whole cell.  So a flip also
+    has to get hold of every cell it changes; if another thread has one
+    of them, the flip waits for it.  Nothing else can change around the
+    site meanwhile, so the flip is still the one that was drawn.  With
+    only a few cells the threads mostly wait on each other.
+
+    The grid is shifted by a random offset every sweep so the tile edges
+    don't stay put.
+*/
+
+/*******************************************************************************/
+/*** Sets up the tiles and locks ***/
+
+void initSweeps()
+{
+  // one flip touches sites up to chunkSize+3 away from the chosen site
+  int minTile = 2*(chunkSize+3);
+
+  numTiles = N/minTile;
+  numTiles -= numTiles%2;
+
+  tileSites.assign( numTiles*numTiles, std::vector<int>() );
+  tileStamp.assign( N*N, 0 );
+  tileListing = 0;
+
+  if(numThreads>1 && numTiles<2)
+    printf("\n  Warning: lattice too small for parallel sweeps, flipping serially.\n\n");
+
+  #ifdef _OPENMP
+  omp_set_num_threads( numThreads );
+  cellLocks.resize( numCells+1 );
+  for(int cell=0;cell<=numCells;cell++)
+    omp_init_lock( &cellLocks[cell] );
+  #endif
+}
+
+/*******************************************************************************/
+/*** Makes a number of flip attempts across the lattice in parallel ***/
+
+int sweep(int proposals)
+{
+  int accepted = 0;
+
+  if(numTiles<2){
+    for(int count=0; count<proposals; count++)
+      accepted+=flip();
+    return accepted;
+  }
+
+  double energy = 0.0;
+
+  int offsetI = randomInt(N);
+  int offsetJ = randomInt(N);
+  int firstColor = randomInt(4);
+
+  int half = numTiles/2;
+  int tiles = numTiles*numTiles;
+
+  listTileSites( offsetI, offsetJ, -1 );
+  long perimeter = 0;
+  for(int tile=0;tile<tiles;tile++)
+    perimeter += tileSites[tile].size();
+  if(perimeter==0)
+    return 0;
+
+  // exactly the proposals asked for, shared out by perimeter: the
+  // leftover ones go one each to tiles with any, from a random one on
+  std::vector<int> attempts( tiles );
+  int leftover = proposals;
+  for(int tile=0;tile<tiles;tile++){
+    attempts[tile] = ( (long)proposals*(long)tileSites[tile].size() )/perimeter;
+    leftover -= attempts[tile];
+  }
+  for(int tile=randomInt(tiles); leftover>0; tile=(tile+1)%tiles){
+    if(!tileSites[tile].empty()){
+      attempts[tile]++;
+      leftover--;
+    }
+  }
+
+  for(int c=0;c<4;c++){
+
+    int color = (firstColor+c)%4;
+
+    // the tiles done so far have moved the perimeters along their edges
+    if(c>0)
+      listTileSites( offsetI, offsetJ, color );
+
+    #pragma omp parallel for schedule(dynamic) reduction(+:accepted,energy)
+    for(int t=0;t<half*half;t++){
+
+      int ti = 2*(t/half)+color/2;
+      int tj = 2*(t%half)+color%2;
+
+      int i0 = offsetI + (ti*N)/numTiles;
+      int j0 = offsetJ + (tj*N)/numTiles;
+      int height = ((ti+1)*N)/numTiles - (ti*N)/numTiles;
+      int width  = ((tj+1)*N)/numTiles - (tj*N)/numTiles;
+
+      #ifdef _OPENMP
+      threadStream = &threadStreams[ omp_get_thread_num() ];
+      threadProfile = &threadProfiles[ omp_get_thread_num() ];
+      #else
+      threadStream = &threadStreams[0];
+      threadProfile = &threadProfiles[0];
+      #endif
+
+      int tile = ti*numTiles+tj;
+
+      for(int n=0;n<attempts[tile];n++){
+        if( tileFlip( tile, i0, j0, height, width ) ){
+          accepted++;
+          energy+=deltaEnergy;
+        }
+      }
+
+      threadStream = &mainStream;
+      threadProfile = &mainProfile;
+    }
+  }
+
+  totalEnergy+=energy;
+
+  return accepted;
+}
+
+/*******************************************************************************/
+/*** Lists the perimeter sites of every tile of a colour ***/
+
+// All four colours with color -1.  Every site listed gets the new
+// listing's stamp, so tileFlip() can tell which ones are in already.
+
+void listTileSites(int offsetI, int offsetJ, int color)
+{
+  tileListing++;
+
+  for(int tile=0;tile<numTiles*numTiles;tile++)
+    if( color<0 || ((tile/numTiles)%2)*2+(tile%numTiles)%2==color )
+      tileSites[tile].clear();
+
+  for(int cell=1;cell<=numCells;cell++){
+    for(int n=0;n<(int)cellPerimeterList[cell].size();n++){
+      int i = cellPerimeterList[cell][n].first;
+      int j = cellPerimeterList[cell][n].second;
+      int tile = tileOf( i, j, offsetI, offsetJ );
+      if( color<0 || ((tile/numTiles)%2)*2+(tile%numTiles)%2==color ){
+        tileSites[tile].push_back( i*N+j );
+        tileStamp[i*N+j] = tileListing;
+      }
+    }
+  }
+}
+
+// the tile a site is in, ti*numTiles+tj, the way sweep() cuts them
+
+int tileOf(int i, int j, int offsetI, int offsetJ)
+{
+  int r = (N+i-offsetI%N)%N;
+  int c = (N+j-offsetJ%N)%N;
+  int ti = (r*numTiles)/N;
+  int tj = (c*numTiles)/N;
+  while( ((ti+1)*N)/numTiles<=r ) ti++;
+  while( ((tj+1)*N)/numTiles<=c ) tj++;
+  return ti*numTiles+tj;
+}
+
+/*******************************************************************************/
+/*** One flip attempt at a perimeter site of a tile ***/
+
+// Same moves as choose(), from the tile's list.  Sites that are no longer
+// on a perimeter are taken off the list as they are drawn, and the ones an
+// accepted flip puts on one are added.  Only this thread changes the
+// sites of the tile while it runs, so neither needs a lock.
+
+int tileFlip(int tile, int i0, int j0, int height, int width)
+{
+  static const int whichDir[4] = { 0, 0, 1, 1 };
+  static const int thingDir[4] = { 1, -1, 1, -1 };
+
+  // a tile can be all sites whose flips would split their cell, which
+  // choose() can't run into with whole cells to choose from
+  static const int MAX_DRAWS = 1000;
+
+  std::vector<int> &sites = tileSites[tile];
+
+  PROFILE_START;
+
+  bool contiguous = false;
+  for(int draws=0; !contiguous; draws++){
+
+    if(sites.empty() || draws==MAX_DRAWS){
+      PROFILE_LAP( PHASE_PROPOSAL );
+      return 0;
+    }
+
+    int n = randomInt( sites.size() );
+    iSite = sites[n]/N;
+    jSite = sites[n]%N;
+    oldCell = lattice[iSite][jSite][0];
+    if( oldCell==0 || !isPerimeter(iSite,jSite) ){
+      tileStamp[ sites[n] ] = 0;
+      sites[n] = sites.back();
+      sites.pop_back();
+      continue;
+    }
+
+    int dirs[4];
+    int numDirs = 0;
+    for(int d=0; d<4; d++){
+      int neighbor;
+      if(whichDir[d]==0)
+        neighbor = lattice[(N+iSite+thingDir[d])%N][jSite][0];
+      else
+        neighbor = lattice[iSite][(N+jSite+thingDir[d])%N][0];
+      if(neighbor!=oldCell)
+        dirs[numDirs++] = d;
+    }
+
+    int d = dirs[ randomInt(numDirs) ];
+    int which = whichDir[d];
+    int thing = thingDir[d];
+    if(which==0)
+      newCell = lattice[(N+iSite+thing)%N][jSite][0];
+    else
+      newCell = lattice[iSite][(N+jSite+thing)%N][0];
+
+    // Choose to invade or surrender
+
+    if(randomInt(2)==0){
+      int tmp = oldCell;
+      oldCell = newCell;
+      newCell = tmp;
+      if(which==0)
+        iSite = (N+iSite+thing)%N;
+      else
+        jSite = (N+jSite+thing)%N;
+    }
+
+    contiguous = maintainsContiguity();
+    PROFILE_COUNT( PROFILE_PROPOSALS, 1 );
+    PROFILE_COUNT( PROFILE_CONTIGUITY, !contiguous );
+  }
+
+  // Every cell the chunk changes, and every cell next to it, whose
+  // contacts change with it
+
+  int cells[ (2*MAX_CHUNK+3)*(2*MAX_CHUNK+3)+1 ];
+  int count = 0;
+  cells[count++] = newCell;
+  for(int i=iSite-chunkSize-1;i<=iSite+chunkSize+1;i++){
+    for(int j=jSite-chunkSize-1;j<=jSite+chunkSize+1;j++){
+      int cell = lattice[(N+i)%N][(N+j)%N][0];
+      bool seen = false;
+      for(int n=0;n<count;n++)
+        seen = seen || cells[n]==cell;
+      if(!seen)
+        cells[count++] = cell;
+    }
+  }
+
+  if(!lockCells( cells, count )){
+    PROFILE_COUNT( PROFILE_LOCKED, 1 );
+    while(!lockCells( cells, count ))
+      ;
+  }
+  PROFILE_LAP( PHASE_PROPOSAL );
+
+  int accepted = attemptFlip();
+
+  unlockCells( cells, count );
+
+  // the flip moved the perimeters up to a site past the chunk
+  if(accepted){
+    for(int i=iSite-chunkSize-1;i<=iSite+chunkSize+1;i++){
+      for(int j=jSite-chunkSize-1;j<=jSite+chunkSize+1;j++){
+        int x = (N+i)%N, y = (N+j)%N;
+        if( (N+x-i0%N)%N>=height || (N+y-j0%N)%N>=width )
+          continue;
+        if( lattice[x][y][0]!=0 && isPerimeter(x,y) && tileStamp[x*N+y]!=tileListing ){
+          sites.push_back( x*N+y );
+          tileStamp[x*N+y] = tileListing;
+        }
+      }
+    }
+  }
+
+  return accepted;
+}
+
+/*******************************************************************************/
+/*** Gets hold of cells for a flip, or none of them if one is taken ***/
+
+// Air (cell 0) has no per-cell state, so it is never locked.
+
+bool lockCells(int *cells, int count)
+{
+  #ifdef _OPENMP
+  for(int n=0;n<count;n++){
+    if( cells[n]!=0 && !omp_test_lock( &cellLocks[ cells[n] ] ) ){
+      unlockCells( cells, n );
+      return false;
+    }
+  }
+  #endif
+  return true;
+}
+
+void unlockCells(int *cells, int count)
+{
+  #ifdef _OPENMP
+  for(int n=0;n<count;n++)
+    if( cells[n]!=0 )
+      omp_unset_lock( &cellLocks[ cells[n] ] );
+  #endif
+}
+
+/*******************************************************************************/
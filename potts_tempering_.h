@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*******************************************************************************/
+/*** PARALLEL TEMPERING FUNCTIONS ***/
+
+  enum { MAX_REPLICAS = 64 };
+
+  // shared by every replica's process
+  struct temperingState
+  {
+    pthread_barrier_t barrier;
+    randomStream stream;                 // for the swaps
+    int    replicas;
+    double ladder[MAX_REPLICAS];         // beta of every slot, lowest first
+    double energy[MAX_REPLICAS];         // of every replica, at the last swap
+    int    slot[MAX_REPLICAS];           // the slot every replica is in
+    int    replicaAt[MAX_REPLICAS];      // the replica in every slot
+    long   rounds;
+    long   tried[MAX_REPLICAS];          // swaps of slot s and s+1
+    long   swapped[MAX_REPLICAS];
+    char   fname[400];                   // aaa_tempering_.txt
+  };
+
+  temperingState *tempering = NULL;
+  int temperingRank = -1;                // this process's replica, -1 if none
+
+  void  runTempering(const char *dname);
+  void  runTemperingReplica(int rank, const char *dname);
+  void  temperingSwap(int loop);
+  void  writeTemperingSlots(int loop);
+  void  printTemperingLog(const char *fname);
+
+/*
+    With REPLICAS more than 1, potts runs that many copies of the
+    simulation at once, at betas from BETA up to BETA MAX in even ratios,
+    and every SWAP EVERY loops offers neighbouring betas the chance to
+    trade places: replicas at b and b' with energies E and E' swap with
+    probability min(1, exp((b-b')(E-E'))), from the totalEnergy they
+    already keep.  A cell stuck in a stellate shape at a low temperature
+    gets carried up to where it can let go and back down again, which
+    takes far fewer loops than waiting for it at the low temperature.
+
+    The simulation state is all global, so like a batch (see
+    potts_batch_.h) every replica is a process of its own, replica_<n>
+    in the output directory.  A swap never moves a lattice: the replicas
+    trade betas instead, which is the same exchange and copies nothing.
+    So a replica's own files follow one configuration as it wanders up
+    and down the ladder; aaa_tempering_.txt in the output directory has,
+    at every swap, the slot (0 for BETA, REPLICAS-1 for BETA MAX) each
+    replica is in, to sort them back out by temperature.
+
+    The replicas meet at a process shared barrier.  The energies and the
+    ladder are in shared memory, and whichever replica gets there last
+    makes the swaps, with a random stream of its own, so a run is
+    repeated by its SEED.  Replica n is seeded with SEED+n-1.  The swap
+    acceptance of every pair of slots goes to aaa_log_.txt.
+
+    A tempering run can't be resumed as one; its replicas' checkpoints
+    are written as always.
+*/
+
+/*******************************************************************************/
+/*** Runs REPLICAS simulations, swapping their betas ***/
+
+void runTempering(const char *dname)
+{
+  char fname[400];
+
+  if(numReplicas>MAX_REPLICAS){
+    printf("\n Nope... at most %d REPLICAS, not %d\n\n",MAX_REPLICAS,numReplicas);
+    exit(1);
+  }
+  if(beta<=0.0 || betaMax<=0.0){
+    printf("\n Nope... BETA and BETA MAX have to be above 0\n\n");
+    exit(1);
+  }
+  if(resumeDir[0]!='\0'){
+    printf("\n Nope... a tempering run can't be resumed, only its replicas one at a time with REPLICAS=1\n\n");
+    exit(1);
+  }
+  if(swapEvery<1)
+    swapEvery = 1;
+  if(seed==0)
+    seed = time(0);
+
+  tempering = (temperingState*)mmap( NULL, sizeof(temperingState), PROT_READ|PROT_WRITE,
+                                     MAP_SHARED|MAP_ANONYMOUS, -1, 0 );
+  if(tempering==MAP_FAILED){
+    printf("\n Nope... can't share memory between the replicas\n\n");
+    exit(1);
+  }
+  memset( tempering, 0, sizeof(temperingState) );
+
+  pthread_barrierattr_t shared;
+  pthread_barrierattr_init( &shared );
+  pthread_barrierattr_setpshared( &shared, PTHREAD_PROCESS_SHARED );
+  pthread_barrier_init( &tempering->barrier, &shared, numReplicas );
+  pthread_barrierattr_destroy( &shared );
+
+  tempering->replicas = numReplicas;
+  for(int s=0;s<numReplicas;s++){
+    tempering->ladder[s] = beta*pow( betaMax/beta, (double)s/(numReplicas-1) );
+    tempering->slot[s] = s;
+    tempering->replicaAt[s] = s;
+  }
+  seedStream( tempering->stream, seed, 1+numThreads );   // past every stream of replica 1
+
+  mkdir(dname,0755);
+  sprintf(tempering->fname,"%s/aaa_tempering_.txt",dname);
+  FILE* outFile=fopen(tempering->fname,"w");
+  if(outFile!=NULL)
+    fclose(outFile);
+  writeTemperingSlots(0);
+
+  printf("  Tempering %d replicas from beta %lf to %lf...\n\n",numReplicas,beta,betaMax);
+  fflush(stdout);
+
+  std::vector<pid_t> pids;
+  for(int rank=0;rank<numReplicas;rank++){
+    pid_t pid = fork();
+    if(pid==0){
+      runTemperingReplica( rank, dname );
+      _exit(0);
+    }
+    if(pid<0){
+      printf("\n Nope... can't start replica %d\n\n",rank+1);
+      for(int n=0;n<(int)pids.size();n++)
+        kill( pids[n], SIGTERM );
+      exit(1);
+    }
+    pids.push_back( pid );
+  }
+
+  // the rest would wait at the barrier for a replica that died forever
+  int finished = 0, failed = 0, status;
+  while( finished<numReplicas && wait(&status)>=0 ){
+    finished++;
+    if( !WIFEXITED(status) || WEXITSTATUS(status)!=0 ){
+      if(failed==0)
+        for(int n=0;n<(int)pids.size();n++)
+          kill( pids[n], SIGTERM );
+      failed++;
+    }
+    printf("\r    finished = %d of %d",finished,numReplicas);
+    fflush(stdout);
+  }
+  printf("\n\n");
+
+  strcpy(fname,dname);
+  strcat(fname,"/aaa_log_.txt");
+  printTemperingLog(fname);
+
+  if(failed>0)
+    printf("  Warning: a replica failed, the run was stopped.\n\n");
+  printf("  Done.\n\n");
+
+  pthread_barrier_destroy( &tempering->barrier );
+  munmap( tempering, sizeof(temperingState) );
+  tempering = NULL;
+}
+
+/*******************************************************************************/
+/*** Runs one replica, in its own process ***/
+
+void runTemperingReplica(int rank, const char *dname)
+{
+  char rdir[300];
+  char fname[350];
+
+  temperingRank = rank;
+  beta = tempering->ladder[ tempering->slot[rank] ];
+  seed += rank;
+
+  sprintf(rdir,"%s/replica_%d",dname,rank+1);
+  mkdir(rdir,0755);
+  sprintf(fname,"%s/aaa_stdout_.txt",rdir);
+  if( freopen(fname,"w",stdout)==NULL )
+    _exit(1);
+
+  simulate(rdir);
+
+  fflush(stdout);
+}
+
+/*******************************************************************************/
+/*** Offers neighbouring betas a swap, called by every replica ***/
+
+void temperingSwap(int loop)
+{
+  tempering->energy[temperingRank] = totalEnergy;
+
+  if( pthread_barrier_wait( &tempering->barrier )==PTHREAD_BARRIER_SERIAL_THREAD ){
+    randomStream *own = threadStream;
+    threadStream = &tempering->stream;
+
+    // even rounds pair slots 0-1, 2-3, ..., odd rounds 1-2, 3-4, ...
+    for(int s=tempering->rounds%2; s+1<tempering->replicas; s+=2){
+      int a = tempering->replicaAt[s];
+      int b = tempering->replicaAt[s+1];
+      double exponent = (tempering->ladder[s]-tempering->ladder[s+1])*
+                        (tempering->energy[a]-tempering->energy[b]);
+      tempering->tried[s]++;
+      if( exponent>=0.0 || exp(exponent)>uniformRandom() ){
+        tempering->replicaAt[s] = b;
+        tempering->replicaAt[s+1] = a;
+        tempering->slot[a] = s+1;
+        tempering->slot[b] = s;
+        tempering->swapped[s]++;
+      }
+    }
+    tempering->rounds++;
+
+    threadStream = own;
+    writeTemperingSlots(loop);
+  }
+
+  pthread_barrier_wait( &tempering->barrier );
+
+  double newBeta = tempering->ladder[ tempering->slot[temperingRank] ];
+  if(newBeta!=beta){
+    beta = newBeta;
+    if(engine==1)
+      initNfold();   // every rate has changed
+  }
+}
+
+/*******************************************************************************/
+/*** Adds the slot of every replica to aaa_tempering_.txt ***/
+
+void writeTemperingSlots(int loop)
+{
+  FILE* outFile=fopen(tempering->fname,"a");
+  if(outFile==NULL)
+    return;
+  fprintf(outFile,"%5d ",loop);
+  for(int r=0;r<tempering->replicas;r++)
+    fprintf(outFile," %2d",tempering->slot[r]);
+  fprintf(outFile,"\n");
+  fclose(outFile);
+}
+
+/*******************************************************************************/
+/*** Print the ladder and how often its rungs swapped ***/
+
+void printTemperingLog(const char *fname)
+{
+  FILE* pfile=fopen(fname,"w");
+  if(pfile==NULL)
+    return;
+
+  fprintf(pfile,"REPLICAS\t%d\n",tempering->replicas);
+  fprintf(pfile,"SWAP EVERY\t%d\n",swapEvery);
+  fprintf(pfile,"SEED\t\t%d\n\n",seed);
+  fprintf(pfile,"SLOT\tbeta\t\tswaps with the next\n");
+  for(int s=0;s<tempering->replicas;s++){
+    fprintf(pfile,"%d\t%lf",s,tempering->ladder[s]);
+    if(s+1<tempering->replicas)
+      fprintf(pfile,"\t%ld of %ld",tempering->swapped[s],tempering->tried[s]);
+    fprintf(pfile,"\n");
+  }
+  fprintf(pfile,"\n");
+
+  fclose(pfile);
+}
+
+/*******************************************************************************/
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+
+/*******************************************************************************/
+/*** OUTPUT WRITER FUNCTIONS ***/
+
+  struct outputRecord
+  {
+    std::string       fname;
+    std::vector<char> data;
+    bool              append;   // add to the end of the file rather than replace it
+    bool              stop;     // last record, the writer quits after it
+  };
+
+  void  startWriter();
+  void  stopWriter();
+  void  writeOutput(const char *fname, const char *data, size_t size, bool append);
+  void  queueRecord(outputRecord &r);
+  void  writeRecord(outputRecord &r);
+  void  flushAppends();
+  void  closeAppends();
+  void  writerLoop();
+
+  std::vector<outputRecord> writerQueue;
+  std::atomic<unsigned long> writerHead(0);   // records queued so far
+  std::atomic<unsigned long> writerTail(0);   // records written so far
+  std::thread writerThread;
+  std::mutex  writerMutex;                    // only for waiting on the two below
+  std::condition_variable writerWork;         // the writer waits here for records
+  std::condition_variable writerRoom;         // ... and writeOutput() for a free slot
+  bool writerRunning = false;
+  unsigned long writerStalls = 0;             // times the queue was full
+
+  std::map<std::string, FILE*> appendFiles;  // every file the writer has open to append to
+
+/*
+    The energy trace and the lattices are handed to a writer thread
+    rather than written from the Monte Carlo loop.  The loop only formats
+    a record (which it has to do anyway, the lattice keeps changing) and
+    puts it in a ring of OUTPUT QUEUE slots; the writer takes them out
+    and does the writing.  There is one producer and one consumer, so
+    the ring needs no lock, only the two counters; the mutex is there so
+    either side can sleep until the other moves its counter.
+
+    The traces are appended to a few lines at a time, several files in
+    turn, so the writer keeps every file it appends to open until
+    stopWriter() and flushes them once it has emptied the ring, not
+    after every record.  A whole file, a checkpoint say, is only written
+    once everything appended before it is flushed, so it never gets to
+    the disk ahead of the lines it goes with.
+
+    If the writer falls OUTPUT QUEUE records behind, writeOutput() waits
+    for a free slot, so a slow disk slows the run down rather than eating
+    memory.  stopWriter() writes out everything that is left; it is also
+    run at exit.  With OUTPUT QUEUE 0 everything is written on the spot.
+*/
+
+/*******************************************************************************/
+/*** Starts the writer thread ***/
+
+void startWriter()
+{
+  static bool registered = false;
+
+  if(outputQueue<=0 || writerRunning)
+    return;
+
+  writerQueue.assign( outputQueue, outputRecord() );
+  writerHead = 0;
+  writerTail = 0;
+  writerStalls = 0;
+  writerRunning = true;
+  writerThread = std::thread( writerLoop );
+
+  if(!registered){
+    atexit( stopWriter );
+    registered = true;
+  }
+}
+
+/*******************************************************************************/
+/*** Writes out whatever is queued and stops the writer thread ***/
+
+void stopWriter()
+{
+  if(writerRunning){
+    outputRecord last;
+    last.append = false;
+    last.stop = true;
+
+    queueRecord(last);
+    writerThread.join();
+    writerRunning = false;
+  }
+
+  closeAppends();
+}
+
+/*******************************************************************************/
+/*** Queues data to be written to a file ***/
+
+void writeOutput(const char *fname, const char *data, size_t size, bool append)
+{
+  outputRecord r;
+  r.fname = fname;
+  r.data.assign( data, data+size );
+  r.append = append;
+  r.stop = false;
+
+  if(!writerRunning){
+    writeRecord(r);
+    flushAppends();
+    return;
+  }
+
+  queueRecord(r);
+}
+
+// back pressure: waits for the writer to free a slot
+
+void queueRecord(outputRecord &r)
+{
+  if( writerHead-writerTail>=writerQueue.size() ){
+    writerStalls++;
+    std::unique_lock<std::mutex> lock( writerMutex );
+    writerRoom.wait( lock, []{ return writerHead-writerTail<writerQueue.size(); } );
+  }
+
+  std::swap( writerQueue[ writerHead%writerQueue.size() ], r );
+  {
+    std::lock_guard<std::mutex> lock( writerMutex );
+    writerHead++;
+  }
+  writerWork.notify_one();
+}
+
+/*******************************************************************************/
+/*** The writer thread ***/
+
+void writerLoop()
+{
+  threadProfile = &writerProfile;
+
+  while(true){
+    if(writerTail==writerHead){
+      std::unique_lock<std::mutex> lock( writerMutex );
+      writerWork.wait( lock, []{ return writerTail!=writerHead; } );
+    }
+
+    outputRecord &r = writerQueue[ writerTail%writerQueue.size() ];
+    bool stop = r.stop;
+    PROFILE_START;
+    if(!stop)
+      writeRecord(r);
+    PROFILE_LAP( PHASE_WRITE );
+    std::vector<char>().swap( r.data );
+    {
+      std::lock_guard<std::mutex> lock( writerMutex );
+      writerTail++;
+    }
+    writerRoom.notify_one();
+
+    if(stop)
+      return;
+
+    // caught up: flush the batch just written
+    if(writerTail==writerHead){
+      flushAppends();
+      PROFILE_LAP( PHASE_WRITE );
+    }
+  }
+}
+
+/*******************************************************************************/
+/*** Writes one record to its file ***/
+
+void writeRecord(outputRecord &r)
+{
+  std::map<std::string, FILE*>::iterator open = appendFiles.find( r.fname );
+
+  // whole files go to a temporary first, so they are never seen half written
+  if(!r.append){
+    flushAppends();
+    if(open!=appendFiles.end()){
+      fclose(open->second);
+      appendFiles.erase(open);
+    }
+    std::string temporary = r.fname+".tmp";
+    FILE *pfile=fopen(temporary.c_str(),"wb");
+    if(pfile==NULL)
+      return;
+    if(!r.data.empty())
+      fwrite( &r.data[0], 1, r.data.size(), pfile );
+    fclose(pfile);
+    rename( temporary.c_str(), r.fname.c_str() );
+    return;
+  }
+
+  if(open==appendFiles.end()){
+    FILE *pfile=fopen(r.fname.c_str(),"ab");
+    if(pfile==NULL)
+      return;
+    open = appendFiles.insert( std::make_pair(r.fname,pfile) ).first;
+  }
+  if(!r.data.empty())
+    fwrite( &r.data[0], 1, r.data.size(), open->second );
+}
+
+void flushAppends()
+{
+  std::map<std::string, FILE*>::iterator f;
+  for(f=appendFiles.begin();f!=appendFiles.end();f++)
+    fflush(f->second);
+}
+
+void closeAppends()
+{
+  std::map<std::string, FILE*>::iterator f;
+  for(f=appendFiles.begin();f!=appendFiles.end();f++)
+    fclose(f->second);
+  appendFiles.clear();
+}
+
+/*******************************************************************************/
@@ -2,13 +2,17 @@
 
 echo "numCollagen \t anisotropy"
 
+batchDir="10_23_13"
+batchFile="${batchDir}_batch.txt"
+
+rm -f $batchFile
 for i in {1..50}
 do 
-	dirName="10_23_13/direction${i}"
-	./potts $dirName
+	echo "direction${i}" >> $batchFile
 
 done;
 
-echo "\n\nfinished all experiments"
+./potts -b $batchFile $batchDir
 
+echo "\n\nfinished all experiments"
 